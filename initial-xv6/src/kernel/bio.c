@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,15 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * bprefetch starts reading a block that will be wanted soon;
+//     the disk driver hands the buffer back through bdone.
+// * bclaim is bread for a block the caller will overwrite whole.
+//
+// Buffers are hashed on (dev, blockno) into NBUCKET chains,
+// each with its own lock, so lookups of different blocks
+// don't contend. Recycling picks the unused buffer with the
+// oldest lastuse timestamp; bcache.lock serializes recycling,
+// which is the only code that holds two bucket locks.
 
 
 #include "types.h"
@@ -23,69 +32,177 @@
 #include "fs.h"
 #include "buf.h"
 
+#define NBUCKET 61
+
+// A commit holds up to LOGSIZE log buffers locked and LOGSIZE
+// home buffers pinned, and the transaction open meanwhile pins
+// up to LOGSIZE more. Leave room besides for a read-ahead
+// window (RAMAX in fs.c) and the blocks ops have in hand.
+#if NBUF < 3*LOGSIZE + 32 + 2*MAXOPBLOCKS
+#error "NBUF is too small for the log (make NBUF=n)"
+#endif
+
 struct {
-  struct spinlock lock;
+  struct spinlock lock; // serializes recycling
   struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // Each bucket is a circular list through prev/next,
+  // with a dummy head; the lock protects the list and
+  // refcnt, dev, blockno and lastuse of its buffers.
+  struct {
+    struct spinlock lock;
+    struct buf head;
+  } bucket[NBUCKET];
 } bcache;
 
+static uint
+bhash(uint dev, uint blockno)
+{
+  return (dev * 31 + blockno) % NBUCKET;
+}
+
+// Link b at the front of bucket h.
+static void
+blink(int h, struct buf *b)
+{
+  b->next = bcache.bucket[h].head.next;
+  b->prev = &bcache.bucket[h].head;
+  bcache.bucket[h].head.next->prev = b;
+  bcache.bucket[h].head.next = b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  for(int h = 0; h < NBUCKET; h++){
+    initlock(&bcache.bucket[h].lock, "bcache.bucket");
+    bcache.bucket[h].head.prev = &bcache.bucket[h].head;
+    bcache.bucket[h].head.next = &bcache.bucket[h].head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Spread the buffers over the buckets; they move to
+  // the right bucket when first recycled.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    blink((b - bcache.buf) % NBUCKET, b);
+  }
+}
+
+// Find block (dev, blockno) in bucket h.
+// Caller must hold the bucket's lock.
+static struct buf*
+bfind(int h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.bucket[h].head.next; b != &bcache.bucket[h].head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
   }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For read-ahead, return 0 instead if the block is
+// already cached or every buffer is in use.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ra)
 {
-  struct buf *b;
-
-  acquire(&bcache.lock);
+  struct buf *b, *victim;
+  int h = bhash(dev, blockno), vh = -1;
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
+  acquire(&bcache.bucket[h].lock);
+  if((b = bfind(h, dev, blockno)) != 0 && !ra)
+    b->refcnt++;
+  release(&bcache.bucket[h].lock);
+  if(b){
+    if(ra)
+      return 0;
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached. Check again once we are the only one
+  // recycling, in case someone else just cached it.
+  acquire(&bcache.lock);
+  acquire(&bcache.bucket[h].lock);
+  if((b = bfind(h, dev, blockno)) != 0){
+    if(!ra)
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+    release(&bcache.bucket[h].lock);
+    release(&bcache.lock);
+    if(ra)
+      return 0;
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  // Recycle the least recently used (LRU) unused buffer,
+  // keeping the lock of the bucket holding the best so far.
+  victim = 0;
+  for(int i = 0; i < NBUCKET; i++){
+    int better = 0;
+    if(i != h)
+      acquire(&bcache.bucket[i].lock);
+    for(b = bcache.bucket[i].head.next; b != &bcache.bucket[i].head; b = b->next){
+      if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        better = 1;
+      }
+    }
+    if(better){
+      if(vh >= 0 && vh != h && vh != i)
+        release(&bcache.bucket[vh].lock);
+      vh = i;
+    } else if(i != h){
+      release(&bcache.bucket[i].lock);
+    }
+  }
+  if(victim == 0){
+    if(ra){
+      release(&bcache.bucket[h].lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      return 0;
     }
+    panic("bget: no buffers");
+  }
+
+  if(vh != h){
+    victim->next->prev = victim->prev;
+    victim->prev->next = victim->next;
+    release(&bcache.bucket[vh].lock);
+    blink(h, victim);
+  }
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->refcnt = 1;
+  release(&bcache.bucket[h].lock);
+  release(&bcache.lock);
+  acquiresleep(&victim->lock);
+  return victim;
+}
+
+// Drop a reference to b, which must not be locked.
+// Stamp it with the time it became unused, for LRU recycling.
+static void
+bput(struct buf *b)
+{
+  int h = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->lastuse = tickupdate();
   }
-  panic("bget: no buffers");
+  release(&bcache.bucket[h].lock);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +211,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +219,40 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block without reading
+// it, for a caller that will overwrite all of b->data and then
+// set b->valid.
+struct buf*
+bclaim(uint dev, uint blockno)
+{
+  return bget(dev, blockno, 0);
+}
+
+// Start reading the indicated block into the cache without
+// waiting for it. The buffer stays locked, so a bread of the
+// block sleeps until bdone hands it over.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  b->async = 1;
+  virtio_disk_start(b, 0);
+}
+
+// Called by the disk driver, in interrupt context, when
+// a read started by bprefetch has finished.
+void
+bdone(struct buf *b)
+{
+  b->async = 0;
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,7 +263,6 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +270,23 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
-
-
@@ -1,11 +1,13 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int async;   // read-ahead: disk releases buf when done
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks when refcnt last dropped to 0
+  struct buf *prev; // hash bucket list
   struct buf *next;
   uchar data[BSIZE];
 };
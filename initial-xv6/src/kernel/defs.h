@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct lockbench;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -12,8 +13,11 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bclaim(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bprefetch(uint, uint);
+void            bdone(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -36,6 +40,7 @@ int             filewrite(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
+void            dcset(struct inode*, char*, uint);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -63,6 +68,8 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kref(void *);
+int             krefcount(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -103,10 +110,19 @@ void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
+int             preempt(void);
+void            schedtimer(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// prof.c
+void            profinit(void);
+void            profsample(uint64, int);
+uint64          profnext(void);
+int             profctl(uint64);
+int             profread(uint64, int);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
@@ -114,6 +130,9 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            freelock(struct spinlock*);
+int             lockstat(uint64, int);
+void            lockbench(uint64, struct lockbench*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
@@ -143,10 +162,15 @@ void            syscall();
 
 // trap.c
 extern uint     ticks;
+extern uint     nextwake;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            clockintr(void);
+uint            tickupdate(void);
+void            timerset(uint64);
+void            ipi(int);
 
 // uart.c
 void            uartinit(void);
@@ -165,6 +189,8 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             cowfault(pagetable_t, uint64);
+uint64          vmfault(pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -183,11 +209,14 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_writev(uint *, uchar **, int);
 void            virtio_disk_intr(void);
 
 // waitx
 int             waitx(uint64, uint*, uint*);
-void            update_time(void);
+void            charge(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -60,29 +60,93 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+// When balloc() cannot continue at its goal, it looks for this
+// many free blocks in a row, leaving room for the blocks that
+// sequential writes will ask for next.
+#define BRUN 8
+
+// Mark block b, whose bitmap block bp holds, in use and zero it.
 static uint
-balloc(uint dev)
+btake(uint dev, struct buf *bp, uint b)
 {
-  int b, bi, m;
-  struct buf *bp;
+  bp->data[(b % BPB)/8] |= 1 << (b % 8);  // Mark block in use.
+  log_write(bp);
+  brelse(bp);
+  bzero(dev, b);
+  return b;
+}
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+// Take the first block of the first run of n free blocks,
+// searching from goal's bitmap word and wrapping around.
+// The bitmap is scanned 64 bits at a time, so full and
+// empty stretches cost one test per word.
+// Returns 0 if there is no such run.
+static uint
+bfind(uint dev, uint goal, int n)
+{
+  struct buf *bp = 0;
+  uint64 w;
+  uint nw = (sb.size + 63) / 64;
+  uint i, b, start = 0;
+  int bi, run = 0;
+
+  for(i = 0; i < nw; i++){
+    b = (goal / 64 + i) % nw * 64;
+    if(bp == 0 || b % BPB == 0){
+      // Runs don't span bitmap blocks, or wrap.
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+      bp = bread(dev, BBLOCK(b, sb));
+      run = 0;
+    }
+    w = ((uint64*)bp->data)[(b % BPB) / 64];
+    if(w == ~0UL){
+      run = 0;
+      continue;
+    }
+    if(w == 0 && b + 64 <= sb.size){
+      if(run == 0)
+        start = b;
+      run += 64;
+      if(run >= n)
+        return btake(dev, bp, start);
+      continue;
+    }
+    for(bi = 0; bi < 64 && b + bi < sb.size; bi++){
+      if(w & (1UL << bi)){
+        run = 0;
+        continue;
       }
+      if(run++ == 0)
+        start = b + bi;
+      if(run >= n)
+        return btake(dev, bp, start);
     }
+  }
+  if(bp)
     brelse(bp);
+  return 0;
+}
+
+// Allocate a zeroed disk block: goal if it is free, else the
+// start of a free run of BRUN blocks, else any free block.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal)
+{
+  struct buf *bp;
+  uint b;
+
+  if(goal > 0 && goal < sb.size){
+    bp = bread(dev, BBLOCK(goal, sb));
+    if((bp->data[(goal % BPB)/8] & (1 << (goal % 8))) == 0)
+      return btake(dev, bp, goal);
+    brelse(bp);
+  } else {
+    goal = 0;
   }
+  if((b = bfind(dev, goal, BRUN)) != 0 || (b = bfind(dev, goal, 1)) != 0)
+    return b;
   printf("balloc: out of blocks\n");
   return 0;
 }
@@ -134,13 +198,15 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. A free entry keeps its inode, still
+//   findable by iget(), until it is recycled, least
+//   recently freed first.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -167,26 +233,52 @@ bfree(int dev, uint b)
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those fields,
+// or the hash chains and free list that link entries.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH]; // entries holding an inode, by inum
+  struct inode free;          // free entries, most recently freed first
 } itable;
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &itable.hash[(dev * 31 + inum) % NIHASH];
+}
+
+// Put entry ip, whose ref has fallen to 0, on the free list.
+static void
+ifree(struct inode *ip)
+{
+  ip->next = itable.free.next;
+  ip->prev = &itable.free;
+  itable.free.next->prev = ip;
+  itable.free.next = ip;
+}
+
+static void dcinit(void);
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  itable.free.next = itable.free.prev = &itable.free;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
+    ifree(&itable.inode[i]);
   }
+  dcinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -246,31 +338,41 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        // Free but still valid: take it off the free list.
+        ip->next->prev = ip->prev;
+        ip->prev->next = ip->next;
+      }
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently freed entry.
+  ip = itable.free.prev;
+  if(ip == &itable.free)
     panic("iget: no inodes");
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  if(ip->inum){
+    for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = *ihash(dev, inum);
+  *ihash(dev, inum) = ip;
   release(&itable.lock);
 
   return ip;
@@ -310,6 +412,8 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->ranext = ip->rawin = ip->raend = 0;
+    ip->goal = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -357,7 +461,8 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0)
+    ifree(ip);
   release(&itable.lock);
 }
 
@@ -374,7 +479,22 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The last NDINDIRECT
+// are listed in the NINDIRECT indirect blocks that are
+// themselves listed in block ip->addrs[NDIRECT+1].
+
+// Allocate a block for ip, aiming for the one after the block
+// last allocated to it, so that a file written sequentially
+// is laid out contiguously.
+static uint
+iballoc(struct inode *ip)
+{
+  uint addr;
+
+  if((addr = balloc(ip->dev, ip->goal)) != 0)
+    ip->goal = addr + 1;
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -387,7 +507,7 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -399,7 +519,7 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
@@ -407,7 +527,7 @@ bmap(struct inode *ip, uint bn)
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip);
       if(addr){
         a[bn] = addr;
         log_write(bp);
@@ -416,6 +536,41 @@ bmap(struct inode *ip, uint bn)
     brelse(bp);
     return addr;
   }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load doubly-indirect block, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0){
+      addr = iballoc(ip);
+      if(addr == 0)
+        return 0;
+      ip->addrs[NDIRECT+1] = addr;
+    }
+    // Then the indirect block it lists for bn.
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn / NINDIRECT]) == 0){
+      addr = iballoc(ip);
+      if(addr){
+        a[bn / NINDIRECT] = addr;
+        log_write(bp);
+      }
+    }
+    brelse(bp);
+    if(addr == 0)
+      return 0;
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn % NINDIRECT]) == 0){
+      addr = iballoc(ip);
+      if(addr){
+        a[bn % NINDIRECT] = addr;
+        log_write(bp);
+      }
+    }
+    brelse(bp);
+    return addr;
+  }
 
   panic("bmap: out of range");
 }
@@ -425,9 +580,9 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i, j, k;
+  struct buf *bp, *bp2;
+  uint *a, *a2;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -448,7 +603,29 @@ itrunc(struct inode *ip)
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j] == 0)
+        continue;
+      bp2 = bread(ip->dev, a[j]);
+      a2 = (uint*)bp2->data;
+      for(k = 0; k < NINDIRECT; k++){
+        if(a2[k])
+          bfree(ip->dev, a2[k]);
+      }
+      brelse(bp2);
+      bfree(ip->dev, a[j]);
+    }
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
   ip->size = 0;
+  ip->raend = 0;
+  ip->goal = 0;
   iupdate(ip);
 }
 
@@ -464,6 +641,44 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read-ahead window limits, in blocks.
+#define RAMIN 2
+#define RAMAX 32
+
+// readi has just read blocks [bn, end) of ip.
+// If that continues the previous read, grow the window and
+// start reading the blocks after end in the background;
+// a seek shrinks the window back to nothing.
+// Blocks below ip->size always exist, so bmap won't allocate.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn, uint end)
+{
+  uint b, addr, last;
+
+  if(bn == ip->ranext || bn + 1 == ip->ranext){
+    if(ip->rawin == 0)
+      ip->rawin = RAMIN;
+    else if(ip->rawin < RAMAX)
+      ip->rawin *= 2;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = end;
+  if(ip->rawin == 0)
+    return;
+
+  last = min(end + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  for(b = ip->raend > end ? ip->raend : end; b < last; b++){
+    if((addr = bmap(ip, b)) == 0)
+      break;
+    bprefetch(ip->dev, addr);
+  }
+  if(b > ip->raend)
+    ip->raend = b;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -471,13 +686,15 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, bn, end;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  bn = off/BSIZE;
+  end = (off + n + BSIZE - 1)/BSIZE;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -492,6 +709,10 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     }
     brelse(bp);
   }
+  // prefetch once this read is done, so that it doesn't
+  // queue behind blocks nobody has asked for yet.
+  if(n > 0)
+    readahead(ip, bn, end);
   return tot;
 }
 
@@ -546,6 +767,131 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache: (dev, directory inum, name) -> inum,
+// with inum 0 recording that the name is absent. Entries are
+// hashed, and recycled least recently used first.
+//
+// dirlookup() fills it, and dirlink() and unlink() update it,
+// all with the directory locked, so an entry always agrees
+// with its directory. "." and ".." are not cached, so when a
+// directory is removed (it must be empty) no stale positive
+// entry survives for a new directory that reuses its inum.
+#define NDCACHE 256
+#define NDCHASH 61
+
+struct dcentry {
+  uint dev;
+  uint dinum;      // directory's inum; 0 if entry unused
+  char name[DIRSIZ];
+  uint inum;       // 0 if name is absent
+  struct dcentry *hnext; // hash chain
+  struct dcentry *prev;  // LRU list, most recent first
+  struct dcentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dcentry entry[NDCACHE];
+  struct dcentry *hash[NDCHASH];
+  struct dcentry head;
+} dcache;
+
+static void
+dcinit(void)
+{
+  struct dcentry *e;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(e = dcache.entry; e < dcache.entry+NDCACHE; e++){
+    e->next = dcache.head.next;
+    e->prev = &dcache.head;
+    dcache.head.next->prev = e;
+    dcache.head.next = e;
+  }
+}
+
+static int
+dchash(uint dinum, char *name)
+{
+  uint h = dinum;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + name[i];
+  return h % NDCHASH;
+}
+
+static int
+dcskip(char *name)
+{
+  return namecmp(name, ".") == 0 || namecmp(name, "..") == 0;
+}
+
+// Find the entry for name in dp and make it most recently used.
+// Caller must hold dcache.lock.
+static struct dcentry*
+dcfind(struct inode *dp, char *name)
+{
+  struct dcentry *e;
+
+  for(e = dcache.hash[dchash(dp->inum, name)]; e; e = e->hnext){
+    if(e->dev == dp->dev && e->dinum == dp->inum && namecmp(e->name, name) == 0){
+      e->next->prev = e->prev;
+      e->prev->next = e->next;
+      e->next = dcache.head.next;
+      e->prev = &dcache.head;
+      dcache.head.next->prev = e;
+      dcache.head.next = e;
+      return e;
+    }
+  }
+  return 0;
+}
+
+// If name in dp is cached, set *inum and return 1.
+static int
+dclookup(struct inode *dp, char *name, uint *inum)
+{
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dp, name)) != 0)
+    *inum = e->inum;
+  release(&dcache.lock);
+  return e != 0;
+}
+
+// Record that name in dp is inum, or absent if inum is 0.
+// Caller must hold dp's lock.
+void
+dcset(struct inode *dp, char *name, uint inum)
+{
+  struct dcentry *e, **pe;
+
+  if(dcskip(name))
+    return;
+  acquire(&dcache.lock);
+  if((e = dcfind(dp, name)) == 0){
+    // Recycle the least recently used entry.
+    e = dcache.head.prev;
+    if(e->dinum){
+      for(pe = &dcache.hash[dchash(e->dinum, e->name)]; *pe != e; pe = &(*pe)->hnext)
+        ;
+      *pe = e->hnext;
+    }
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+    e->hnext = dcache.hash[dchash(dp->inum, name)];
+    dcache.hash[dchash(dp->inum, name)] = e;
+    dcfind(dp, name);
+  }
+  e->inum = inum;
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -557,6 +903,9 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(poff == 0 && !dcskip(name) && dclookup(dp, name, &inum))
+    return inum ? iget(dp->dev, inum) : 0;
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -567,10 +916,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcset(dp, name, inum);
       return iget(dp->dev, inum);
     }
   }
 
+  dcset(dp, name, 0);
   return 0;
 }
 
@@ -601,6 +952,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcset(dp, name, inum);
 
   return 0;
 }
@@ -1,6 +1,11 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps a cache of free pages so most kalloc()
+// and kfree() calls touch no shared lock; caches refill
+// from and spill to the global kmem list KBATCH pages
+// at a time.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +14,8 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KBATCH 32 // pages moved between a CPU cache and kmem
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -23,20 +30,86 @@ struct {
   struct run *freelist;
 } kmem;
 
+// Reference counts of allocated pages, updated atomically.
+// fork() shares pages copy-on-write, so kfree() only
+// frees a page when its last reference goes.
+int pageref[(PHYSTOP - KERNBASE) / PGSIZE];
+#define PAGEREF(pa) pageref[((uint64)(pa) - KERNBASE) / PGSIZE]
+
+// Per-CPU free page caches. The lock is only contended
+// when another CPU steals from an empty system.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} kcache[NCPU];
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   freerange(end, (void*)PHYSTOP);
 }
 
+// Put the pages in [pa_start, pa_end) on the global list.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
+  struct run *r;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  acquire(&kmem.lock);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    r = (struct run*)p;
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+  }
+  release(&kmem.lock);
+}
+
+// Move up to KBATCH pages from kmem to kc.
+// Caller must hold kc->lock.
+static void
+refill(struct kcache *kc)
+{
+  struct run *head, *tail;
+  int n;
+
+  acquire(&kmem.lock);
+  head = tail = kmem.freelist;
+  for(n = 1; tail && n < KBATCH && tail->next; n++)
+    tail = tail->next;
+  if(tail){
+    kmem.freelist = tail->next;
+    tail->next = kc->freelist;
+    kc->freelist = head;
+    kc->nfree += n;
+  }
+  release(&kmem.lock);
+}
+
+// Move KBATCH pages from kc back to kmem.
+// Caller must hold kc->lock, and kc must have
+// more than KBATCH pages.
+static void
+spill(struct kcache *kc)
+{
+  struct run *head, *tail;
+  int n;
+
+  head = tail = kc->freelist;
+  for(n = 1; n < KBATCH; n++)
+    tail = tail->next;
+  kc->freelist = tail->next;
+  kc->nfree -= KBATCH;
+
+  acquire(&kmem.lock);
+  tail->next = kmem.freelist;
+  kmem.freelist = head;
+  release(&kmem.lock);
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -47,19 +120,71 @@ void
 kfree(void *pa)
 {
   struct run *r;
+  struct kcache *kc;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  int ref = __sync_sub_and_fetch(&PAGEREF(pa), 1);
+  if(ref < 0)
+    panic("kfree: ref");
+  if(ref > 0)
+    return;
+
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  if(kc->nfree > 2*KBATCH)
+    spill(kc);
+  release(&kc->lock);
+  pop_off();
+}
+
+// Add a reference to an allocated page.
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+  __sync_fetch_and_add(&PAGEREF(pa), 1);
+}
+
+// Number of references to an allocated page.
+int
+krefcount(void *pa)
+{
+  return PAGEREF(pa);
+}
+
+// Take one page from another CPU's cache, for when
+// this CPU's cache and the global list are both empty.
+static struct run *
+steal(int self)
+{
+  struct run *r = 0;
+
+  for(int i = 0; i < NCPU && r == 0; i++){
+    if(i == self)
+      continue;
+    acquire(&kcache[i].lock);
+    r = kcache[i].freelist;
+    if(r){
+      kcache[i].freelist = r->next;
+      kcache[i].nfree--;
+    }
+    release(&kcache[i].lock);
+  }
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +194,31 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
+  int id;
+
+  push_off();
+  id = cpuid();
+  kc = &kcache[id];
+  acquire(&kc->lock);
+  if(kc->freelist == 0)
+    refill(kc);
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->nfree--;
+  }
+  release(&kc->lock);
+  if(r == 0)
+    r = steal(id);
+  pop_off();
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
   if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+    PAGEREF(r) = 1;
 
+#ifdef KALLOC_DEBUG
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
@@ -0,0 +1,19 @@
+// Statistics for one spinlock, as returned by lockstat().
+struct lockstat {
+  char name[16];      // Name given to initlock()
+  uint64 addr;        // Kernel address of the lock
+  uint64 nacquire;    // Acquisitions
+  uint64 ncontend;    // Acquisitions that found the lock held
+  uint64 nspin;       // Spin loop iterations
+  uint64 holdcycles;  // Total time held, in mtime cycles
+};
+
+// Results of one lockbench() run, for the calling process.
+struct lockbench {
+  int cpu;               // CPU the run ended on
+  uint64 nacquire;       // Times it got the benchmark lock
+  uint64 waitcycles;     // Total mtime cycles spent waiting for it
+  uint64 maxwait;        // Longest single wait
+  uint64 nhandoff;       // Acquisitions straight after another CPU
+  uint64 handoffcycles;  // Total release-to-acquire time for those
+};
@@ -10,16 +10,23 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// calls. A transaction is committed only when it has no FS
+// system calls active. Thus there is never any reasoning
+// required about whether a commit might write an uncommitted
+// system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the transaction has been committed.
+//
+// A commit first copies the transaction's blocks into log
+// buffers in memory. From then on a new transaction is open,
+// and FS system calls carry on in it while the copy is written
+// to the log and installed from there. Calls that arrive during
+// a commit are all committed together by the next one (group
+// commit).
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +35,8 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends, and installs, are each one batch of disk
+// writes, sent together and waited for together.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -43,11 +51,22 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int copying;     // commit() is copying lh; begin_op() waits.
   int dev;
-  struct logheader lh;
+  struct logheader lh; // the open transaction
 };
 struct log log;
 
+// The transaction being committed. Only the committing
+// thread uses this.
+struct {
+  struct logheader lh;
+  struct buf *buf[LOGSIZE];  // locked log buffers, filled in
+  struct buf *home[LOGSIZE]; // cache buffers, pinned
+  uint blockno[LOGSIZE];     // for virtio_disk_writev()
+  uchar *data[LOGSIZE];
+} ctrans;
+
 static void recover_from_log(void);
 static void commit();
 
@@ -56,6 +75,8 @@ initlog(int dev, struct superblock *sb)
 {
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
+  if (sb->nlog < LOGSIZE+1)
+    panic("initlog: log too small");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
@@ -64,24 +85,6 @@ initlog(int dev, struct superblock *sb)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
-static void
-install_trans(int recovering)
-{
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
-  }
-}
-
 // Read the log header from disk into the in-memory log header
 static void
 read_head(void)
@@ -96,30 +99,46 @@ read_head(void)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write *lh to disk as the log header.
+// This is the true point at which a transaction
+// commits, or is erased if lh->n is 0.
 static void
-write_head(void)
+write_head(struct logheader *lh)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
 }
 
+// Copy committed blocks from log to their home location
+static void
+replay(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.lh.n; tail++) {
+    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+    bwrite(dbuf);  // write dst to disk
+    brelse(lbuf);
+    brelse(dbuf);
+  }
+}
+
 static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  replay(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -128,7 +147,7 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.copying){
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
@@ -142,7 +161,9 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and no commit is already under way; if one is,
+// it commits this transaction when it is done.
 void
 end_op(void)
 {
@@ -150,9 +171,9 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.copying)
+    panic("log.copying");
+  if(log.outstanding == 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -167,39 +188,89 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the open transaction's modified blocks from cache
+// into log buffers, and open a new transaction.
+// Caller must have set log.copying, with no outstanding
+// operations, so the blocks cannot change underneath.
 static void
-write_log(void)
+copy_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+  ctrans.lh = log.lh;
+  for (tail = 0; tail < ctrans.lh.n; tail++) {
+    struct buf *to = bclaim(log.dev, log.start+tail+1); // log block
+    struct buf *from = bread(log.dev, ctrans.lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    to->valid = 1;
+    ctrans.buf[tail] = to;
+    ctrans.home[tail] = from;
+    ctrans.data[tail] = to->data;
     brelse(from);
-    brelse(to);
   }
+
+  acquire(&log.lock);
+  log.lh.n = 0;
+  log.copying = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
+// Write the copied log buffers to disk, in one batch.
+static void
+write_log(void)
+{
+  int tail;
+
+  for (tail = 0; tail < ctrans.lh.n; tail++)
+    ctrans.blockno[tail] = log.start+tail+1;
+  virtio_disk_writev(ctrans.blockno, ctrans.data, ctrans.lh.n);
+}
+
+// Write the copied blocks to their home locations, in one batch.
+// The copy, not the cache, is the source: the open transaction
+// may already have changed the cached blocks.
+static void
+install_trans(void)
+{
+  int tail;
+
+  for (tail = 0; tail < ctrans.lh.n; tail++)
+    ctrans.blockno[tail] = ctrans.lh.block[tail];
+  virtio_disk_writev(ctrans.blockno, ctrans.data, ctrans.lh.n);
+  for (tail = 0; tail < ctrans.lh.n; tail++) {
+    bunpin(ctrans.home[tail]);
+    brelse(ctrans.buf[tail]);
+  }
+}
+
+// Commit the open transaction, then any that gathered
+// while it was being written. Caller has set log.committing.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  struct logheader empty;
+
+  empty.n = 0;
+  acquire(&log.lock);
+  while (log.outstanding == 0 && log.lh.n > 0) {
+    log.copying = 1;
+    release(&log.lock);
+
+    copy_log();      // Snapshot modified blocks; new ops may start
+    write_log();     // Write the snapshot to the log
+    write_head(&ctrans.lh); // Write header to disk -- the real commit
+    install_trans(); // Now install writes to home locations
+    write_head(&empty); // Erase the transaction from the log
+
+    acquire(&log.lock);
   }
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -217,7 +288,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= LOGSIZE)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -233,4 +304,3 @@ log_write(struct buf *b)
   }
   release(&log.lock);
 }
-
@@ -1,13 +1,20 @@
-#define NPROC        64  // maximum number of processes
+#ifndef NPROC
+#define NPROC      2048  // maximum number of processes (make NPROC=n)
+#endif
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#ifndef NINODE
+#define NINODE      200  // maximum number of active i-nodes (make NINODE=n)
+#endif
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      (MAXOPBLOCKS*4)  // max data blocks in on-disk log
+#ifndef NBUF
+#define NBUF         256  // size of disk block cache (make NBUF=n)
+#endif
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define TICKCYCLES   1000000 // timer cycles per tick; about 1/10th second in qemu
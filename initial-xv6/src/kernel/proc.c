@@ -10,54 +10,231 @@
 //   struct spinlock lock;
 //   struct proc procs[NPROC];
 // } ptable;
-// Queue management
-struct proc *queues[NQUEUE][NPROC]; // Array of queues
-int queue_sizes[NQUEUE];            // Sizes of each queue
-int current_time = 0;
 
-// Function to push a process to the specified queue
-void push(int queue_num, struct proc *p)
+// Wake one idle hart, if any, to look for work.
+// Callers make the work visible first; the fence pairs
+// with the one in idle() so that either we see c->idle
+// or the idle hart sees the work.
+static void
+kickidle(void)
 {
-  // Ensure we do not exceed the queue size limit
-  if (queue_sizes[queue_num] < 128)
+  struct cpu *c;
+
+  __sync_synchronize();
+  for (c = cpus; c < &cpus[NCPU]; c++)
   {
-    queues[queue_num][queue_sizes[queue_num]] = p; // Add process to the end of the queue
-    queue_sizes[queue_num]++;                      // Increment the queue size
-    p->in_queue = 1;
-    // p>ticks=                     // Mark the process as in the queue
+    if (c->idle)
+    {
+      ipi(c - cpus);
+      return;
+    }
   }
-  // else
-  // {
-  //   // Handle the case where the queue is full (optional)
-  // }
 }
-struct proc *pop(int queue_num)
+
+#ifdef SCHEDULER_MLFQ
+// MLFQ queue management.
+// Each CPU owns a set of NQUEUE run queues (see struct cpu),
+// protected by that CPU's qlock. A RUNNABLE process sits on
+// exactly one CPU's queues until a scheduler pops it; lock
+// order is p->lock, then qlock.
+#define BOOST_TICKS 48 // move everything back to level 0 this often
+
+// Queues are intrusive doubly-linked lists through p->qnext and
+// p->qprev; bit i of c->qmask is set iff level i is non-empty,
+// so every operation below is O(1) regardless of NPROC.
+
+// Function to push a process to the tail of the specified queue.
+// Caller must hold c->qlock.
+static void
+push(struct cpu *c, int queue_num, struct proc *p)
 {
-  if (queue_sizes[queue_num] == 0)
-  {
+  if (p->in_queue)
+    panic("push: already queued");
+  p->qnext = 0;
+  p->qprev = c->qtail[queue_num];
+  if (p->qprev)
+    p->qprev->qnext = p;
+  else
+    c->qhead[queue_num] = p;
+  c->qtail[queue_num] = p;
+  c->qmask |= 1 << queue_num;
+  c->nqueued++;
+  p->in_queue = 1;
+  p->level = queue_num;
+  p->enter_ticks = tickupdate();
+}
+
+// Unlink p from the specified queue.
+// Caller must hold c->qlock.
+static void
+unqueue(struct cpu *c, int queue_num, struct proc *p)
+{
+  if (p->qprev)
+    p->qprev->qnext = p->qnext;
+  else
+    c->qhead[queue_num] = p->qnext;
+  if (p->qnext)
+    p->qnext->qprev = p->qprev;
+  else
+    c->qtail[queue_num] = p->qprev;
+  if (c->qhead[queue_num] == 0)
+    c->qmask &= ~(1 << queue_num);
+  p->qnext = p->qprev = 0;
+  c->nqueued--;
+  p->in_queue = 0;
+}
+
+// Remove and return the head of the highest-priority
+// non-empty queue, or 0 if c has nothing queued.
+// Caller must hold c->qlock.
+static struct proc *
+pop(struct cpu *c)
+{
+  int i;
+  struct proc *p;
+
+  if (c->qmask == 0)
     return 0; // No process to pop
+  for (i = 0; (c->qmask & (1 << i)) == 0; i++)
+    ;
+  p = c->qhead[i];
+  unqueue(c, i, p);
+
+  // A boost may have spliced p up from a lower level;
+  // note that it has been applied so enqueue() won't redo it.
+  p->level = i;
+  if ((uint)p->enter_ticks < c->boosted)
+  {
+    p->ticks = 0;
+    p->enter_ticks = c->boosted;
+  }
+  return p;
+}
+
+// Time slice, in ticks, for each priority level.
+static int
+timeslice(int level)
+{
+  switch (level)
+  {
+  case 0:
+    return 1; // 1 tick for priority 0
+  case 1:
+    return 4; // 4 ticks for priority 1
+  case 2:
+    return 8; // 8 ticks for priority 2
+  default:
+    return 16; // 16 ticks for priority 3
   }
+}
+
+// Apply the periodic priority boost to c's queues by splicing
+// every lower level onto the tail of level 0; pop() fixes up
+// p->level and p->ticks as processes come off. Processes that
+// are not queued at boost time (running or sleeping) are
+// boosted by enqueue() when they next become RUNNABLE.
+// Caller must hold c->qlock.
+static void
+boost(struct cpu *c)
+{
+  uint now = tickupdate();
+  uint epoch = now - now % BOOST_TICKS;
 
-  struct proc *p = queues[queue_num][0]; // Get the front process
-  for (int i = 0; i < queue_sizes[queue_num] - 1; i++)
+  if (c->boosted == epoch)
+    return;
+  c->boosted = epoch;
+  for (int i = 1; i < NQUEUE; i++)
   {
-    queues[queue_num][i] = queues[queue_num][i + 1]; // Shift processes left
+    if (c->qhead[i] == 0)
+      continue;
+    if (c->qtail[0])
+    {
+      c->qtail[0]->qnext = c->qhead[i];
+      c->qhead[i]->qprev = c->qtail[0];
+    }
+    else
+      c->qhead[0] = c->qhead[i];
+    c->qtail[0] = c->qtail[i];
+    c->qhead[i] = c->qtail[i] = 0;
   }
-  queue_sizes[queue_num]--; // Decrease the queue size
-  p->in_queue = 0;          // Mark the process as not in the queue
-  return p;                 // Return the popped process
-}
-
-// // Function to get the time slice for a given priority level
-// int get_time_slice(int level) {
-//     switch (level) {
-//         case 0: return 1;  // 1 tick for priority 0
-//         case 1: return 4;  // 4 ticks for priority 1
-//         case 2: return 8;  // 8 ticks for priority 2
-//         case 3: return 16; // 16 ticks for priority 3
-//         default: return 1; // Default case
-//     }
-// }
+  if (c->qmask)
+    c->qmask = 1;
+}
+
+// Put RUNNABLE process p on the tail of its level on cpu c.
+// Caller must hold p->lock.
+static void
+enqueue(struct cpu *c, struct proc *p)
+{
+  uint now = tickupdate();
+  uint epoch = now - now % BOOST_TICKS;
+
+  acquire(&c->qlock);
+  if ((uint)p->enter_ticks < epoch)
+  {
+    // Missed a boost while off the queues.
+    p->level = 0;
+    p->ticks = 0;
+  }
+  push(c, p->level, p);
+  p->lastcpu = c - cpus;
+  release(&c->qlock);
+
+  // Wake c if it is idle, or preempt it if it is running
+  // something of lower priority; otherwise let any idle
+  // hart come and steal p. c->proc may exit and be freed
+  // under us, so look at the level run() noted instead.
+  __sync_synchronize();
+  if (c->idle)
+    ipi(c - cpus);
+  else if (c->runlevel > p->level)
+  {
+    c->resched = 1;
+    ipi(c - cpus);
+  }
+  else
+    kickidle();
+}
+
+// The started CPU with the fewest queued processes.
+// Used to spread new processes; the count is read without
+// qlock since it is only a placement hint.
+static struct cpu *
+leastloaded(void)
+{
+  struct cpu *c, *best = 0;
+
+  for (c = cpus; c < &cpus[NCPU]; c++)
+  {
+    if (c->started && (best == 0 || c->nqueued < best->nqueued))
+      best = c;
+  }
+  return best ? best : &cpus[0];
+}
+
+// Called by an idle CPU: take the highest-priority queued
+// process from the busiest other CPU.
+static struct proc *
+steal(struct cpu *c)
+{
+  struct cpu *v, *victim = 0;
+  struct proc *p;
+
+  for (v = cpus; v < &cpus[NCPU]; v++)
+  {
+    if (v != c && v->nqueued > 0 && (victim == 0 || v->nqueued > victim->nqueued))
+      victim = v;
+  }
+  if (victim == 0)
+    return 0;
+
+  acquire(&victim->qlock);
+  p = pop(victim);
+  release(&victim->qlock);
+  return p;
+}
+#endif
+
 static unsigned int rand_seed = 123456789;
 // kernel/proc.h
 
@@ -75,9 +252,251 @@ int random(void)
   return rand_seed;
 }
 
+#ifdef SCHEDULER_LBS
+// Lottery scheduling state.
+// A RUNNABLE process holds tickets in the lottery until a
+// scheduler draws it. tree[] is a Fenwick tree over p->slot
+// of those tickets, so a draw is O(log NPROC). To settle
+// ties, RUNNABLE processes with the same ticket count form a
+// class, kept in a leftist heap with the oldest at the root,
+// so entering or leaving the lottery is O(log n) as well.
+// class[] hashes ticket counts to a chain of class roots,
+// linked through p->qclass. Lock order is p->lock, then
+// lottery.lock; a queued process's tickets cannot change since
+// only a running process calls settickets().
+struct
+{
+  struct spinlock lock;
+  uint64 tree[NPROC + 1]; // 1-based Fenwick tree, by proc slot
+  uint64 total;           // Tickets held by all queued processes
+  int top;                // Largest power of two <= NPROC
+  struct proc *class[NPROC]; // Class roots, by tickets % NPROC
+  struct proc *proc[NPROC];  // Queued process, by slot
+} lottery;
+
+// Add delta tickets at proc slot i; delta wraps to subtract.
+static void
+fenwick_add(int i, uint64 delta)
+{
+  for (i++; i <= NPROC; i += i & -i)
+    lottery.tree[i] += delta;
+}
+
+// The slot whose tickets cover ticket number r, 0 <= r < total.
+static int
+fenwick_find(uint64 r)
+{
+  int pos = 0;
+
+  for (int step = lottery.top; step > 0; step >>= 1)
+  {
+    if (pos + step <= NPROC && lottery.tree[pos + step] <= r)
+    {
+      pos += step;
+      r -= lottery.tree[pos];
+    }
+  }
+  return pos;
+}
+
+// Is p older than q? Ties on creation time go to the lower pid.
+static int
+older(struct proc *p, struct proc *q)
+{
+  return p->creation_time < q->creation_time ||
+         (p->creation_time == q->creation_time && p->pid < q->pid);
+}
+
+// Merge the leftist heaps a and b, with children in qnext
+// (left) and qprev (right). qrank is the length of a heap's
+// right spine, which is all the merge walks, so it is O(log n).
+static struct proc *
+heap_merge(struct proc *a, struct proc *b)
+{
+  struct proc *t;
+
+  if (a == 0)
+    return b;
+  if (b == 0)
+    return a;
+  if (older(b, a))
+  {
+    t = a;
+    a = b;
+    b = t;
+  }
+  a->qprev = heap_merge(a->qprev, b);
+  if (a->qnext == 0 || a->qnext->qrank < a->qprev->qrank)
+  {
+    t = a->qnext;
+    a->qnext = a->qprev;
+    a->qprev = t;
+  }
+  a->qrank = a->qprev ? a->qprev->qrank + 1 : 1;
+  return a;
+}
+
+// The link that holds the root of the class with the given
+// ticket count: in class[] or in another root's qclass. It
+// holds 0, the end of the chain, if the class is empty.
+static struct proc **
+lottery_class(int tickets)
+{
+  struct proc **pp;
+
+  for (pp = &lottery.class[tickets % NPROC]; *pp && (*pp)->tickets != tickets; pp = &(*pp)->qclass)
+    ;
+  return pp;
+}
+
+// Enter RUNNABLE process p in the lottery.
+// Caller must hold p->lock.
+static void
+lottery_add(struct proc *p)
+{
+  struct proc **pp, *root, *next;
+
+  acquire(&lottery.lock);
+  if (p->in_queue)
+    panic("lottery_add");
+  fenwick_add(p->slot, p->tickets);
+  lottery.proc[p->slot] = p;
+  lottery.total += p->tickets;
+
+  p->qnext = p->qprev = 0;
+  p->qrank = 1;
+  pp = lottery_class(p->tickets);
+  next = *pp ? (*pp)->qclass : 0;
+  root = heap_merge(*pp, p);
+  root->qclass = next;
+  *pp = root;
+  p->in_queue = 1;
+  release(&lottery.lock);
+}
+
+// Take the oldest process in class *pp out of the lottery.
+// Caller must hold lottery.lock.
+static struct proc *
+lottery_remove(struct proc **pp)
+{
+  struct proc *p = *pp, *root;
+
+  fenwick_add(p->slot, -(uint64)p->tickets);
+  lottery.total -= p->tickets;
+  root = heap_merge(p->qnext, p->qprev);
+  if (root)
+  {
+    root->qclass = p->qclass;
+    *pp = root;
+  }
+  else
+    *pp = p->qclass;
+  p->qnext = p->qprev = p->qclass = 0;
+  p->in_queue = 0;
+  return p;
+}
+
+// Hold a lottery and remove the winner, or return 0 if
+// nothing is RUNNABLE. If the drawn process has the same
+// number of tickets as an older one, the older one wins.
+static struct proc *
+lottery_draw(void)
+{
+  struct proc *p = 0;
+
+  acquire(&lottery.lock);
+  if (lottery.total > 0)
+  {
+    p = lottery.proc[fenwick_find((uint64)random() % lottery.total)];
+    p = lottery_remove(lottery_class(p->tickets));
+  }
+  release(&lottery.lock);
+  return p;
+}
+#elif !defined(SCHEDULER_MLFQ)
+// Round robin: a single FIFO of RUNNABLE processes, linked
+// through p->qnext. Lock order is p->lock, then runq.lock.
+struct
+{
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+} runq;
+
+// Append RUNNABLE process p to the run queue.
+// Caller must hold p->lock.
+static void
+runq_add(struct proc *p)
+{
+  acquire(&runq.lock);
+  p->qnext = 0;
+  if (runq.tail)
+    runq.tail->qnext = p;
+  else
+    runq.head = p;
+  runq.tail = p;
+  release(&runq.lock);
+}
+
+// Remove and return the head of the run queue, or 0.
+static struct proc *
+runq_pop(void)
+{
+  struct proc *p;
+
+  acquire(&runq.lock);
+  if ((p = runq.head) != 0)
+  {
+    runq.head = p->qnext;
+    if (runq.head == 0)
+      runq.tail = 0;
+    p->qnext = 0;
+  }
+  release(&runq.lock);
+  return p;
+}
+#endif
+
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// struct procs are carved PROCPERPAGE to a page, behind a small
+// header, and a page goes back to kalloc() when its last proc is
+// freed, so the table grows and shrinks with the load. Pages with
+// a free proc are on procslab.partial. Each proc in a page owns a
+// distinct p->slot < NPROC, which bounds the number of processes,
+// and the kernel stack at KSTACK(p->slot), with a guard page
+// below it. The lock, slot and stack live as long as the page,
+// so that fork and exit don't set them up and tear them down.
+struct procpage
+{
+  struct procpage *next; // On procslab.partial
+  struct procpage *prev;
+  struct proc *free;     // Free procs in this page, through qnext
+  int nused;
+  int nproc;             // Procs in this page, <= PROCPERPAGE
+};
+
+#define PROCPERPAGE ((PGSIZE - sizeof(struct procpage)) / sizeof(struct proc))
+
+struct
+{
+  struct spinlock lock;
+  struct procpage *partial;
+  int slot[NPROC]; // Stack of free slots
+  int nslot;
+} procslab;
+
+// Bumped whenever a kernel stack is mapped or unmapped. Only
+// the hart running a process touches its stack, so run() can
+// flush a hart's TLB lazily, before it runs anything new,
+// rather than interrupting every hart.
+int kstackgen;
+// Every process from fork() to wait(), chained by pid.
+// pid_lock protects the chains and p->pidnext; lock order is
+// wait_lock, then pid_lock, then p->lock.
+#define NPIDHASH 256
+
+static struct proc *pidhash[NPIDHASH];
 
 struct proc *initproc;
 
@@ -91,42 +510,264 @@ extern char trampoline[]; // trampoline.S
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
-// memory model when using p->parent.
+// memory model when using p->parent and
+// the child lists, p->children through
+// each child's p->sibling.
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
+// Carve a new slab page, mapping a kernel stack for each of
+// its procs. Returns 0 if no slots are left or memory is short.
+// Caller must hold procslab.lock.
+static struct procpage *
+procpage_alloc(void)
+{
+  struct procpage *pg;
+  struct proc *p;
+  char *pa;
+
+  if (procslab.nslot == 0 || (pg = (struct procpage *)kalloc()) == 0)
+    return 0;
+  pg->free = 0;
+  pg->nused = 0;
+  pg->nproc = 0;
+  for (p = (struct proc *)(pg + 1); pg->nproc < PROCPERPAGE && procslab.nslot > 0; p++)
+  {
+    p->slot = procslab.slot[--procslab.nslot];
+    p->kstack = KSTACK(p->slot);
+    if ((pa = kalloc()) == 0 ||
+        mappages(kernel_pagetable, p->kstack, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0)
+    {
+      if (pa)
+        kfree(pa);
+      procslab.slot[procslab.nslot++] = p->slot;
+      break;
+    }
+    initlock(&p->lock, "proc");
+    p->qnext = pg->free;
+    pg->free = p;
+    pg->nproc++;
+  }
+  kstackgen++;
+  sfence_vma();
+  if (pg->nproc == 0)
+  {
+    kfree(pg);
+    return 0;
+  }
+  pg->prev = 0;
+  pg->next = 0;
+  return pg;
+}
+
+// Unmap the stacks of slab page pg, which has no procs in use,
+// and free it. Caller must hold procslab.lock.
+static void
+procpage_free(struct procpage *pg)
+{
+  struct proc *p;
+
+  for (p = (struct proc *)(pg + 1); p < (struct proc *)(pg + 1) + pg->nproc; p++)
+  {
+    uvmunmap(kernel_pagetable, p->kstack, 1, 1);
+    procslab.slot[procslab.nslot++] = p->slot;
+    freelock(&p->lock);
+  }
+  kstackgen++;
+  sfence_vma();
+  kfree(pg);
+}
+
+// Take an unused proc from the slab, zeroed but for its lock,
+// slot and kernel stack, or return 0 if NPROC are already
+// allocated or memory is short.
+static struct proc *
+procalloc(void)
+{
+  struct procpage *pg;
+  struct proc *p;
+  uint64 kstack;
+  int slot;
+
+  acquire(&procslab.lock);
+  if ((pg = procslab.partial) == 0)
+  {
+    if ((pg = procpage_alloc()) == 0)
+    {
+      release(&procslab.lock);
+      return 0;
+    }
+    procslab.partial = pg;
+  }
+  p = pg->free;
+  pg->free = p->qnext;
+  if (++pg->nused == pg->nproc)
+  {
+    // Full: off the partial list, which pg heads.
+    procslab.partial = pg->next;
+    if (pg->next)
+      pg->next->prev = 0;
+  }
+  release(&procslab.lock);
+
+  // Zero all but the lock, which is on a lock list.
+  slot = p->slot;
+  kstack = p->kstack;
+  memset(p, 0, (char *)&p->lock - (char *)p);
+  memset(&p->lock + 1, 0, (char *)(p + 1) - (char *)(&p->lock + 1));
+  p->slot = slot;
+  p->kstack = kstack;
+  return p;
+}
+
+// Return p, no longer reachable from anywhere, to the slab.
+static void
+procfree(struct proc *p)
+{
+  struct procpage *pg = (struct procpage *)PGROUNDDOWN((uint64)p);
+
+  acquire(&procslab.lock);
+  p->qnext = pg->free;
+  pg->free = p;
+  if (pg->nused-- == pg->nproc)
+  {
+    pg->prev = 0;
+    pg->next = procslab.partial;
+    if (pg->next)
+      pg->next->prev = pg;
+    procslab.partial = pg;
+  }
+  if (pg->nused == 0)
+  {
+    if (pg->prev)
+      pg->prev->next = pg->next;
+    else
+      procslab.partial = pg->next;
+    if (pg->next)
+      pg->next->prev = pg->prev;
+    procpage_free(pg);
+  }
+  release(&procslab.lock);
+}
 
+// Allocate the page-table pages for every kernel stack's
+// mapping up front, so that mapping and unmapping stacks as
+// slab pages come and go never allocates or frees them.
 void proc_mapstacks(pagetable_t kpgtbl)
+{
+  for (int i = 0; i < NPROC; i++)
+  {
+    if (walk(kpgtbl, KSTACK(i), 1) == 0)
+      panic("proc_mapstacks");
+  }
+}
+
+// Make p findable by its pid.
+// Must be called without p->lock.
+static void
+hashproc(struct proc *p)
+{
+  acquire(&pid_lock);
+  p->pidnext = pidhash[p->pid % NPIDHASH];
+  pidhash[p->pid % NPIDHASH] = p;
+  release(&pid_lock);
+}
+
+// Must be called without p->lock.
+static void
+unhashproc(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for (pp = &pidhash[p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+    ;
+  *pp = p->pidnext;
+  release(&pid_lock);
+}
+
+// The process after p in the pid hash, or the first if p is 0,
+// for walking every process. Caller must hold pid_lock.
+static struct proc *
+nextproc(struct proc *p)
+{
+  int h = 0;
+
+  if (p)
+  {
+    if (p->pidnext)
+      return p->pidnext;
+    h = p->pid % NPIDHASH + 1;
+  }
+  for (; h < NPIDHASH; h++)
+  {
+    if (pidhash[h])
+      return pidhash[h];
+  }
+  return 0;
+}
+
+// Return the process with the given pid, with its lock held,
+// or 0 if there is none.
+struct proc *
+find_proc_by_pid(int pid)
 {
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++)
+  acquire(&pid_lock);
+  for (p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
   {
-    char *pa = kalloc();
-    if (pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int)(p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+    if (p->pid == pid)
+    {
+      acquire(&p->lock);
+      break;
+    }
   }
+  release(&pid_lock);
+  return p;
+}
+
+// Processes in sleep(), hashed by channel, so that wakeup()
+// only looks at the ones sleeping on its channel. Lock order
+// is the caller's lock, then a queue's lock, then p->lock.
+// A process stays linked until it runs again and unlinks itself.
+#define NSLEEPQ 61
+
+struct
+{
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+static int
+sleephash(void *chan)
+{
+  return ((uint64)chan >> 3) % NSLEEPQ;
 }
 
 // initialize the proc table.
 void procinit(void)
 {
-  struct proc *p;
+  struct cpu *c;
   // initlock(&ptable.lock, "ptable");
 
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for (p = proc; p < &proc[NPROC]; p++)
-  {
-    initlock(&p->lock, "proc");
-    p->state = UNUSED;
-    p->kstack = KSTACK((int)(p - proc));
-  }
+  initlock(&procslab.lock, "procslab");
+  for (int i = 0; i < NPROC; i++)
+    procslab.slot[i] = NPROC - 1 - i;
+  procslab.nslot = NPROC;
+  for (int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
+  for (c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->qlock, "runq");
+#ifdef SCHEDULER_LBS
+  initlock(&lottery.lock, "lottery");
+  for (lottery.top = 1; lottery.top * 2 <= NPROC; lottery.top *= 2)
+    ;
+#elif !defined(SCHEDULER_MLFQ)
+  initlock(&runq.lock, "runq");
+#endif
 }
 
 // Must be called with interrupts disabled,
@@ -171,47 +812,47 @@ int allocpid()
   return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// Mark p RUNNABLE and hand it to the scheduler: under MLFQ,
+// queue it on the CPU it last ran on; under LBS, give it
+// tickets in the lottery; otherwise append it to the run
+// queue. p->lock must be held.
+static void
+setrunnable(struct proc *p)
+{
+  p->state = RUNNABLE;
+#ifdef SCHEDULER_MLFQ
+  enqueue(&cpus[p->lastcpu], p);
+#elif defined(SCHEDULER_LBS)
+  lottery_add(p);
+  kickidle();
+#else
+  runq_add(p);
+  kickidle();
+#endif
+}
+
+// Allocate a proc from the slab, initialize state required to
+// run in the kernel, and return with p->lock held. It is not
+// findable by pid until hashproc().
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc *
 allocproc(void)
 {
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++)
-  {
-    acquire(&p->lock);
-    if (p->state == UNUSED)
-    {
-
-      for (int i = 0; i < 31; i++)
-      {
-        p->syscall_count[i] = 0;
-      }
-      goto found;
-    }
-    else
-    {
-      release(&p->lock);
-    }
-  }
-  return 0;
-found:
+  if ((p = procalloc()) == 0)
+    return 0;
   p->pid = allocpid();
+  acquire(&p->lock);
   p->state = USED;
-  p->parent = myproc();
-  p->parent1 = myproc();
   // Allocate a trapframe page.
   if ((p->trapframe = (struct trapframe *)kalloc()) == 0)
   {
     freeproc(p);
-    release(&p->lock);
     return 0;
   }
   p->tickets = 1;           // Default number of tickets
-  p->creation_time = ticks; // Record creation time
+  p->creation_time = tickupdate(); // Record creation time
   p->in_queue = 0;          // This will be used to track the queue
 
   // Set the queue level to 0 (highest priority)
@@ -219,13 +860,13 @@ found:
 
   // Initialize other necessary fields, such as time slices
   p->ticks = 0; // Number of ticks used by the process
-  p->enter_ticks = 0;
+  p->enter_ticks = p->creation_time;
+  p->lastcpu = 0;
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
   if (p->pagetable == 0)
   {
     freeproc(p);
-    release(&p->lock);
     return 0;
   }
 
@@ -237,13 +878,13 @@ found:
   p->context.sp = p->kstack + PGSIZE;
   p->rtime = 0;
   p->etime = 0;
-  p->ctime = ticks;
+  p->ctime = tickupdate();
   return p;
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages. p must not be in the pid hash.
+// p->lock must be held; freeproc releases it.
 static void
 freeproc(struct proc *p)
 {
@@ -261,6 +902,8 @@ freeproc(struct proc *p)
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
+  release(&p->lock);
+  procfree(p);
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -340,12 +983,15 @@ void userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
+  hashproc(p);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growth is lazy: the pages are only reserved here,
+// and vmfault() maps them on first touch.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
 {
@@ -355,10 +1001,11 @@ int growproc(int n)
   sz = p->sz;
   if (n > 0)
   {
-    if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0)
+    if (sz + n > TRAPFRAME)
     {
       return -1;
     }
+    sz += n;
   }
   else if (n < 0)
   {
@@ -385,12 +1032,11 @@ int fork(void)
   if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0)
   {
     freeproc(np);
-    release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
   np->tickets = p->tickets; // Inherit tickets from parent
-  np->creation_time = ticks;
+  np->creation_time = tickupdate();
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -415,10 +1061,16 @@ int fork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
   release(&wait_lock);
+  hashproc(np);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+#ifdef SCHEDULER_MLFQ
+  np->lastcpu = leastloaded() - cpus;
+#endif
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -430,14 +1082,18 @@ void reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for (pp = proc; pp < &proc[NPROC]; pp++)
+  if (p->children == 0)
+    return;
+  for (pp = p->children;; pp = pp->sibling)
   {
-    if (pp->parent == p)
-    {
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+    pp->parent = initproc;
+    if (pp->sibling == 0)
+      break;
   }
+  pp->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -476,9 +1132,10 @@ void exit(int status)
 
   acquire(&p->lock);
 
+  charge();
   p->xstate = status;
   p->state = ZOMBIE;
-  p->etime = ticks;
+  p->etime = mycpu()->charged;
 
   release(&wait_lock);
 
@@ -487,11 +1144,34 @@ void exit(int status)
   panic("zombie exit");
 }
 
+// Add a reaped child's syscall counts, which already include its
+// own reaped children, to its parent's.
+static void
+addcounts(struct proc *p, struct proc *child)
+{
+  for (int i = 0; i < MAX_SYSCALLS; i++)
+    p->syscall_count[i] += child->syscall_count[i];
+}
+
+// Take zombie child *link, whose lock is held, off its parent's
+// child list and free it. Caller must hold wait_lock.
+static void
+reap(struct proc **link)
+{
+  struct proc *p = *link;
+
+  *link = p->sibling;
+  release(&p->lock);
+  unhashproc(p);
+  acquire(&p->lock);
+  freeproc(p);
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int wait(uint64 addr)
 {
-  struct proc *pp;
+  struct proc *pp, **link;
   int havekids, pid;
   struct proc *p = myproc();
 
@@ -499,34 +1179,31 @@ int wait(uint64 addr)
 
   for (;;)
   {
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for (pp = proc; pp < &proc[NPROC]; pp++)
+    for (link = &p->children; (pp = *link) != 0; link = &pp->sibling)
     {
-      if (pp->parent == p)
-      {
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
 
-        havekids = 1;
-        if (pp->state == ZOMBIE)
+      havekids = 1;
+      if (pp->state == ZOMBIE)
+      {
+        // Found one.
+        pid = pp->pid;
+        if (addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                 sizeof(pp->xstate)) < 0)
         {
-          // Found one.
-          pid = pp->pid;
-          if (addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                   sizeof(pp->xstate)) < 0)
-          {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
-        release(&pp->lock);
+        addcounts(p, pp);
+        reap(link);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -591,38 +1268,99 @@ int random_at_most(int max)
   return (my_rand() % max) + 1; // Return a number between 1 and max
 }
 
-void remove_from_queues(struct proc *p)
+// Is there anything for cpu c to run?
+// Called without locks, so the answer is only a hint.
+static int
+anyrunnable(struct cpu *c)
 {
-  for (int j = 0; j < NQUEUE; j++)
+#ifdef SCHEDULER_MLFQ
+  for (c = cpus; c < &cpus[NCPU]; c++)
   {
-    if (queue_sizes[j] > 0)
-    {
-      for (int k = 0; k < queue_sizes[j]; k++)
-      {
-        if (queues[j][k] == p)
-        {
-          // Remove from queue j
-          for (int l = k; l < queue_sizes[j] - 1; l++)
-          {
-            queues[j][l] = queues[j][l + 1];
-          }
-          queue_sizes[j]--;
-          p->in_queue = 0; // Mark as not in queue
-          break;
-        }
-      }
-    }
+    if (c->nqueued > 0)
+      return 1;
+  }
+  return 0;
+#elif defined(SCHEDULER_LBS)
+  return lottery.total > 0;
+#else
+  return runq.head != 0;
+#endif
+}
+
+// Nothing to run: stop the hart with wfi until an ipi() or a
+// device interrupt arrives, with the timer armed only if a
+// sleeper needs waking. Interrupts stay off from the final
+// check through wfi so a kickidle() can't slip in between;
+// wfi still wakes on the pending interrupt.
+static void
+idle(struct cpu *c)
+{
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  if (!anyrunnable(c))
+  {
+    schedtimer();
+    asm volatile("wfi");
+  }
+  c->idle = 0;
+  intr_on();
+
+  // ticks stood still if every hart was idle.
+  clockintr();
+}
+
+// The tick at which p, about to run at tick now, should be
+// preempted.
+static uint
+deadline(struct proc *p, uint now)
+{
+#ifdef SCHEDULER_MLFQ
+  // End of its time slice, or the next boost if sooner.
+  uint d = now + 1;
+  uint boosttick = now - now % BOOST_TICKS + BOOST_TICKS;
+
+  if (p->ticks < timeslice(p->level))
+    d = now + timeslice(p->level) - p->ticks;
+  return d < boosttick ? d : boosttick;
+#else
+  return now + 1;
+#endif
+}
+
+// Switch to chosen process p, whose lock we hold. It is the
+// process's job to release its lock and then reacquire it
+// before jumping back to us.
+static void
+run(struct cpu *c, struct proc *p)
+{
+  p->state = RUNNING;
+  c->proc = p;
+  c->runlevel = p->level;
+  c->charged = tickupdate();
+  c->deadline = deadline(p, c->charged);
+  c->resched = 0;
+  if (c->kstackgen != kstackgen)
+  {
+    // Drop stale kernel stack mappings.
+    c->kstackgen = kstackgen;
+    sfence_vma();
   }
+  schedtimer();
+  swtch(&c->context, &p->context);
+
+  // Process is done running for now.
+  // It should have changed its p->state before coming back.
+  c->proc = 0;
+  c->runlevel = 0;
 }
-int ticks_since_last_boost = 0;
+
 void scheduler(void)
 {
   struct cpu *c = mycpu();
   c->proc = 0;
+  c->started = 1;
 
-  // for (int i = 0; i < NQUEUE; i++) {
-  //     queue_sizes[i] = 0; // Initialize queue sizes to 0
-  // }
   struct proc *p;
   for (;;)
   {
@@ -630,155 +1368,98 @@ void scheduler(void)
     intr_on(); // Ensure this is placed before the process selection begins.
 
 #ifdef SCHEDULER_RR
-    for (p = proc; p < &proc[NPROC]; p++)
+    // Run the process at the head of the run queue.
+    p = runq_pop();
+    if (p == 0)
     {
-      acquire(&p->lock);
+      idle(c);
+      continue;
+    }
+
+    acquire(&p->lock);
+    if (p->state == RUNNABLE)
+    {
+      run(c, p);
+
+      // Preempted: to the back of the queue.
       if (p->state == RUNNABLE)
-      {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+        runq_add(p);
     }
+    release(&p->lock);
 #elif defined(SCHEDULER_LBS)
-   
+    // Run the winner of a lottery among RUNNABLE processes.
+    p = lottery_draw();
+    if (p == 0)
+    {
+      idle(c);
+      continue;
+    }
 
-    // If no chosen process was found, exit early
-    // if (chosen == 0)
-    // {
-    //   continue; // or handle appropriately
-    // }
+    acquire(&p->lock);
+    if (p->state == RUNNABLE)
+    {
+      run(c, p);
 
-    // Check for ties in tickets
+      // Preempted: back into the lottery.
+      if (p->state == RUNNABLE)
+        lottery_add(p);
+    }
+    release(&p->lock);
 
 #elif defined(SCHEDULER_MLFQ)
-    current_time = ticks;
-    // printf("MLFQ\n")
-    // Step 1: Aging Processes
-    for (int i = 0; i < NPROC; i++)
+    // Run the head of the highest-priority non-empty queue on
+    // this CPU, or steal work from another CPU if we have none.
+    acquire(&c->qlock);
+    boost(c);
+    p = pop(c);
+    release(&c->qlock);
+    if (p == 0)
+      p = steal(c);
+    if (p == 0)
     {
-      p = &proc[i];
-
-      if (p->state == ZOMBIE)
-      {
-        remove_from_queues(p); // Skip to next process
-        continue;              // Added to avoid unnecessary locks
-      }
+      idle(c);
+      continue;
     }
 
-    // Step 2: Boost Processes if 48 ticks have passed
-    // ticks_since_last_boost++;
-    if ((ticks % 48) == 0)
+    acquire(&p->lock);
+    if (p->state == RUNNABLE)
     {
-      // printf("%d\n",ticks);
-      for (int i = 0; i < NPROC; i++)
+      run(c, p);
+
+      // Preempted (not sleeping or exiting): demote if it used
+      // its whole time slice, then requeue here.
+      if (p->state == RUNNABLE)
       {
-        p = &proc[i];
-        acquire(&p->lock);
-        if (p->in_queue)
+        if (p->ticks >= timeslice(p->level))
         {
-          // Move the process to the highest priority queue
-          remove_from_queues(p); // Ensure it is removed from any queue
+          if (p->level < NQUEUE - 1)
+            p->level++;
+          p->ticks = 0;
         }
-        p->level = 0;           // Set level to 0
-        p->enter_ticks = ticks; // Reset entry ticks
-        push(0, p);             // Push into queue 0
-        release(&p->lock);
+        enqueue(c, p);
       }
-      ticks_since_last_boost = 0; // Reset the boost counter
     }
+    release(&p->lock);
 
-    // Step 3: Push Processes to Their Corresponding Queues
-    for (int i = 0; i < NPROC; i++)
+#else
+    // Run the process at the head of the run queue.
+    p = runq_pop();
+    if (p == 0)
     {
-      p = &proc[i];
-
-      acquire(&p->lock);
-      if (!p->in_queue)
-      {
-        // Push the process into its corresponding queue
-        push(p->level, p);
-        p->enter_ticks = ticks; // Record when it entered the queue
-      }
-      release(&p->lock);
+      idle(c);
+      continue;
     }
 
-    // Step 4: Loop Through the Queues from Highest to Lowest Priority
-    for (int i = 0; i < NQUEUE; i++)
+    acquire(&p->lock);
+    if (p->state == RUNNABLE)
     {
-      while (queue_sizes[i] > 0)
-      {
-        // Get the next process to run from the highest priority queue
-        p = pop(i);
-        if (p)
-        {
-          if (p->state == RUNNABLE)
-          {
-            acquire(&p->lock);
-            p->state = RUNNING;
-            c->proc = p;
-            p->ticks = 0;
-            swtch(&c->context, &p->context);
-            int timeslice = 0;
-            if (p->level == 0)
-            {
-              timeslice = 1;
-            }
-            else if (p->level == 1)
-            {
-              timeslice = 4;
-            }
-            else if (p->level == 2)
-            {
-              timeslice = 8;
-            }
-            else if (p->level == 3)
-            {
-              timeslice = 16;
-            }
-            if (p->ticks >= timeslice)
-            {
-              if (p->level < NQUEUE)
-              {
-                p->level++;
-              }
-              push(p->level, p); // Push to the next lower queue
-            }
-            c->proc = 0;
-            release(&p->lock);
-          }
-          break;
-        }
-      }
-    }
+      run(c, p);
 
-#else
-    for (p = proc; p < &proc[NPROC]; p++)
-    {
-      acquire(&p->lock);
+      // Preempted: to the back of the queue.
       if (p->state == RUNNABLE)
-      {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+        runq_add(p);
     }
+    release(&p->lock);
 #endif
   }
 }
@@ -799,11 +1480,89 @@ void sched(void)
   if (intr_get())
     panic("sched interruptible");
 
+  // exit() has already charged p and stamped etime.
+  if (p->state != ZOMBIE)
+    charge();
+
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
 }
 
+// Should the running process give up the CPU? Called on
+// timer interrupts and ipis: yes once its deadline has
+// passed or another hart has asked us to reschedule.
+int preempt(void)
+{
+  struct cpu *c;
+  int r;
+
+  push_off();
+  c = mycpu();
+  r = c->resched || tickupdate() >= c->deadline;
+  c->resched = 0;
+  pop_off();
+  return r;
+}
+
+// Program this hart's one-shot timer for the next tick at which
+// it has something to do: the earliest sys_sleep() wakeup, and
+// while a process runs, its deadline, its next sigalarm and the
+// profiler's next sample.
+void schedtimer(void)
+{
+  struct cpu *c;
+  struct proc *p;
+  uint when = nextwake;
+  uint64 t;
+
+  push_off();
+  c = mycpu();
+  if ((p = c->proc) != 0)
+  {
+    if (c->deadline < when)
+      when = c->deadline;
+    if (p->alarmticks > 0)
+    {
+      uint alarm = c->charged + 1;
+      if (p->ticks_elapsed < p->alarmticks)
+        alarm = c->charged + p->alarmticks - p->ticks_elapsed;
+      if (alarm < when)
+        when = alarm;
+    }
+  }
+  t = (when == ~0U) ? ~0UL : (uint64)when * TICKCYCLES;
+  if (p && profnext() < t)
+    t = profnext();
+  timerset(t);
+  pop_off();
+}
+
+// Charge the ticks that have passed since it was last charged
+// to the process running on this CPU. Called when it stops
+// running and before its alarm is checked, so per-tick work
+// only ever touches the running process.
+void charge(void)
+{
+  struct cpu *c;
+  struct proc *p;
+  uint now, n;
+
+  push_off();
+  c = mycpu();
+  if ((p = c->proc) != 0)
+  {
+    now = tickupdate();
+    n = now - c->charged;
+    c->charged = now;
+    p->rtime += n;
+    p->ticks += n;
+    if (p->alarmticks > 0)
+      p->ticks_elapsed += n;
+  }
+  pop_off();
+}
+
 // Give up the CPU for one scheduling round.
 void yield(void)
 {
@@ -840,28 +1599,46 @@ void forkret(void)
 void sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct spinlock *ql = &sleepq[sleephash(chan)].lock;
 
-  // Must acquire p->lock in order to
-  // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Join chan's sleep queue, and acquire p->lock in
+  // order to change p->state and then call sched.
+  // Once we hold the queue's lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks it too),
   // so it's okay to release lk.
 
+  acquire(ql);
+  p->waitprev = 0;
+  p->waitnext = sleepq[sleephash(chan)].head;
+  if (p->waitnext)
+    p->waitnext->waitprev = p;
+  sleepq[sleephash(chan)].head = p;
+
   acquire(&p->lock); // DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  release(ql);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  acquire(ql);
+  if (p->waitprev)
+    p->waitprev->waitnext = p->waitnext;
+  else
+    sleepq[sleephash(chan)].head = p->waitnext;
+  if (p->waitnext)
+    p->waitnext->waitprev = p->waitprev;
+  release(ql);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -870,19 +1647,21 @@ void sleep(void *chan, struct spinlock *lk)
 void wakeup(void *chan)
 {
   struct proc *p;
+  int h = sleephash(chan);
 
-  for (p = proc; p < &proc[NPROC]; p++)
+  acquire(&sleepq[h].lock);
+  for (p = sleepq[h].head; p; p = p->waitnext)
   {
-    if (p != myproc())
+    if (p->chan != chan)
+      continue;
+    acquire(&p->lock);
+    if (p->state == SLEEPING && p->chan == chan)
     {
-      acquire(&p->lock);
-      if (p->state == SLEEPING && p->chan == chan)
-      {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+      setrunnable(p);
     }
+    release(&p->lock);
   }
+  release(&sleepq[h].lock);
 }
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
@@ -891,23 +1670,16 @@ int kill(int pid)
 {
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++)
+  if ((p = find_proc_by_pid(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if (p->state == SLEEPING)
   {
-    acquire(&p->lock);
-    if (p->pid == pid)
-    {
-      p->killed = 1;
-      if (p->state == SLEEPING)
-      {
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+    // Wake process from sleep().
+    setrunnable(p);
   }
-  return -1;
+  release(&p->lock);
+  return 0;
 }
 
 void setkilled(struct proc *p)
@@ -963,7 +1735,8 @@ int either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
-// No lock to avoid wedging a stuck machine further.
+// Only pid_lock, which keeps procs from being freed under us;
+// no p->lock, to avoid wedging a stuck machine further.
 void procdump(void)
 {
   static char *states[] = {
@@ -977,10 +1750,9 @@ void procdump(void)
   char *state;
 
   printf("\n");
-  for (p = proc; p < &proc[NPROC]; p++)
+  acquire(&pid_lock);
+  for (p = nextproc(0); p; p = nextproc(p))
   {
-    if (p->state == UNUSED)
-      continue;
     if (p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
@@ -988,12 +1760,13 @@ void procdump(void)
     printf("%d %s %s", p->pid, state, p->name);
     printf("\n");
   }
+  release(&pid_lock);
 }
 
 // waitx
 int waitx(uint64 addr, uint *wtime, uint *rtime)
 {
-  struct proc *np;
+  struct proc *np, **link;
   int havekids, pid;
   struct proc *p = myproc();
 
@@ -1001,36 +1774,33 @@ int waitx(uint64 addr, uint *wtime, uint *rtime)
 
   for (;;)
   {
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for (np = proc; np < &proc[NPROC]; np++)
+    for (link = &p->children; (np = *link) != 0; link = &np->sibling)
     {
-      if (np->parent == p)
-      {
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&np->lock);
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&np->lock);
 
-        havekids = 1;
-        if (np->state == ZOMBIE)
+      havekids = 1;
+      if (np->state == ZOMBIE)
+      {
+        // Found one.
+        pid = np->pid;
+        *rtime = np->rtime;
+        *wtime = np->etime - np->ctime - np->rtime;
+        if (addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                                 sizeof(np->xstate)) < 0)
         {
-          // Found one.
-          pid = np->pid;
-          *rtime = np->rtime;
-          *wtime = np->etime - np->ctime - np->rtime;
-          if (addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                   sizeof(np->xstate)) < 0)
-          {
-            release(&np->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(np);
           release(&np->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
-        release(&np->lock);
+        addcounts(p, np);
+        reap(link);
+        release(&wait_lock);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -1043,19 +1813,4 @@ int waitx(uint64 addr, uint *wtime, uint *rtime)
     // Wait for a child to exit.
     sleep(p, &wait_lock); // DOC: wait-sleep
   }
-}
-
-void update_time()
-{
-  struct proc *p;
-  for (p = proc; p < &proc[NPROC]; p++)
-  {
-    acquire(&p->lock);
-    if (p->state == RUNNING)
-    {
-      p->rtime++;
-      p->ticks++;
-    }
-    release(&p->lock);
-  }
 }
\ No newline at end of file
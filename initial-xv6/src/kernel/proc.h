@@ -1,5 +1,5 @@
 
-#define MAX_SYSCALLS 31
+#define MAX_SYSCALLS 40
 #define NQUEUE 4 
 struct context
 {
@@ -28,6 +28,22 @@ struct cpu
   struct context context; // swtch() here to enter scheduler().
   int noff;               // Depth of push_off() nesting.
   int intena;             // Were interrupts enabled before push_off()?
+  int started;            // Has this CPU entered scheduler()?
+  int idle;               // Waiting in wfi for an ipi() or device?
+  int resched;            // Preempt c->proc at the next interrupt
+  uint deadline;          // Tick at which to preempt c->proc
+  uint charged;           // Tick up to which c->proc has been charged
+  int runlevel;           // c->proc's level, 0 if none; for enqueue()
+  int kstackgen;          // kstackgen as of this hart's last TLB flush
+
+  // MLFQ run queues, one set per CPU.
+  // qlock must be held when using these:
+  struct spinlock qlock;
+  struct proc *qhead[NQUEUE]; // RUNNABLE processes, by level
+  struct proc *qtail[NQUEUE];
+  uint qmask;                 // Bit i set iff level i is non-empty
+  int nqueued;                // Total across all levels
+  uint boosted;               // Tick of the last boost applied here
 };
 
 extern struct cpu cpus[NCPU];
@@ -101,10 +117,16 @@ struct proc
     int in_queue;          // Flag to check if in a queue
     int enter_ticks;       // Ticks when entered the queue
     int ticks;
+    int lastcpu;           // CPU whose queues p was last placed on
+    struct proc *qnext;    // Run queue links, or LBS class heap children
+    struct proc *qprev;
+    int qrank;             // LBS: right spine length of p's heap
+    struct proc *qclass;   // LBS: next class root in its hash chain
   struct spinlock lock;
   int tickets; // Number of lottery tickets
   uint creation_time;
-  int syscall_count[MAX_SYSCALLS]; // Track up to 31 system calls (assuming maximum 31 syscalls)
+  int syscall_count[MAX_SYSCALLS]; // Calls made, by syscall number,
+                                   // including those of reaped children
   int alarmticks;                  // How many ticks before the alarm goes off
   int ticks_elapsed;               // Ticks elapsed since last alarm
   void (*alarmhandler)();          // Function to call on alarm
@@ -116,17 +138,22 @@ struct proc
   // p->lock must be held when using these:
   enum procstate state; // Process state
   void *chan;           // If non-zero, sleeping on chan
+  struct proc *waitnext; // Sleep queue of chan; its lock protects these
+  struct proc *waitprev;
   int killed;           // If non-zero, have been killed
   int xstate;           // Exit status to be returned to parent's wait
   int pid;              // Process ID
 
-  // wait_lock must be held when using this:
+  // pid_lock must be held when using this:
+  struct proc *pidnext;  // Next in pid hash chain
+
+  // wait_lock must be held when using these:
   struct proc *parent;   // Parent process
-  struct proc *parent1;   // Parent process
-  struct proc *children; // Parent process
-  struct proc *sibling;  // Parent process
+  struct proc *children; // First child not yet reaped
+  struct proc *sibling;  // Next child of the same parent
 
   // these are private to the process, so p->lock need not be held.
+  int slot;                    // Distinct index < NPROC, for KSTACK()
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
@@ -139,5 +166,4 @@ struct proc
   uint ctime;                  // When was the process created
   uint etime;                  // When did the process exited
 };
-extern struct proc proc[NPROC];
 
@@ -0,0 +1,126 @@
+// Sampling profiler.
+//
+// While profctl() has it enabled, a CPU that is running a process
+// asks for a timer interrupt every profinterval mtime cycles, and
+// the trap handlers call profsample() to record where the CPU was,
+// which process was running, and which CPU it was into that CPU's
+// ring. profread() drains the rings. Idle CPUs are left asleep,
+// so the profile only covers time spent doing work.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "prof.h"
+#include "defs.h"
+
+#define NSAMPLE 2048 // samples buffered per CPU
+
+struct {
+  struct spinlock lock;
+  struct profsample ring[NSAMPLE];
+  uint head;       // next slot to fill; ring[tail..head) are full
+  uint tail;
+  uint dropped;    // samples lost because the ring was full
+  uint64 next;     // mtime at which to take the next sample
+} prof[NCPU];
+
+uint64 profinterval;   // mtime cycles between samples; 0 means off
+
+void
+profinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&prof[i].lock, "prof");
+}
+
+// Called on timer interrupts, with interrupts off. Record pc
+// if this CPU is due for a sample.
+void
+profsample(uint64 pc, int user)
+{
+  int id = cpuid();
+  uint64 now;
+  struct proc *p;
+  struct profsample *s;
+
+  if(profinterval == 0)
+    return;
+  now = *(uint64*)CLINT_MTIME;
+  if(now < prof[id].next)
+    return;
+  prof[id].next = now + profinterval;
+
+  p = myproc();
+  acquire(&prof[id].lock);
+  if(prof[id].head - prof[id].tail == NSAMPLE){
+    prof[id].dropped++;
+  } else {
+    s = &prof[id].ring[prof[id].head++ % NSAMPLE];
+    s->pc = pc;
+    s->pid = p ? p->pid : 0;
+    s->cpu = id;
+    s->user = user;
+  }
+  release(&prof[id].lock);
+}
+
+// The mtime at which this CPU wants its next sample,
+// for schedtimer(); ~0 if profiling is off.
+uint64
+profnext(void)
+{
+  if(profinterval == 0)
+    return ~0UL;
+  return prof[cpuid()].next;
+}
+
+// Start sampling every interval mtime cycles with empty rings,
+// or stop if interval is 0. Returns the number of samples
+// dropped since the last call.
+int
+profctl(uint64 interval)
+{
+  int dropped = 0;
+
+  if(interval != 0 && interval < TICKCYCLES / 1000)
+    interval = TICKCYCLES / 1000;
+  profinterval = interval;
+  for(int i = 0; i < NCPU; i++){
+    acquire(&prof[i].lock);
+    dropped += prof[i].dropped;
+    prof[i].dropped = 0;
+    if(interval != 0){
+      prof[i].head = prof[i].tail = 0;
+      prof[i].next = 0;
+    }
+    release(&prof[i].lock);
+  }
+  return dropped;
+}
+
+// Move up to n samples from the rings to the user
+// array at addr. Returns the number moved, or -1.
+int
+profread(uint64 addr, int n)
+{
+  struct profsample buf[32];
+  int i, k, got = 0;
+
+  for(i = 0; i < NCPU && got < n; ){
+    acquire(&prof[i].lock);
+    for(k = 0; k < NELEM(buf) && got + k < n && prof[i].tail != prof[i].head; k++)
+      buf[k] = prof[i].ring[prof[i].tail++ % NSAMPLE];
+    release(&prof[i].lock);
+    if(k == 0){
+      i++;
+      continue;
+    }
+    if(copyout(myproc()->pagetable, addr + got * sizeof(buf[0]), (char*)buf, k * sizeof(buf[0])) < 0)
+      return -1;
+    got += k;
+  }
+  return got;
+}
@@ -0,0 +1,7 @@
+// One sample taken by the kernel profiler, as returned by profread().
+struct profsample {
+  uint64 pc;   // sepc when the sample was taken
+  int pid;     // Process running on the CPU, or 0
+  short cpu;   // CPU the sample was taken on
+  short user;  // Is pc a user address?
+};
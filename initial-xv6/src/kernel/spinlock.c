@@ -6,14 +6,56 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "proc.h"
+#include "lockstat.h"
 #include "defs.h"
 
+// Every lock passed to initlock(), for lockstat(), on a list
+// for the CPU that initialized it, so that locks made and
+// freed on the fly (pipes, say) don't all meet at one lock.
+// The lockreg locks are not themselves on any list.
+struct lockreg {
+  struct spinlock lock;
+  struct spinlock head;
+} lockreg[NCPU];
+
 void
 initlock(struct spinlock *lk, char *name)
 {
+  struct lockreg *r;
+
   lk->name = name;
+#ifdef TICKETLOCK
+  lk->ticket = lk->serving = 0;
+#else
   lk->locked = 0;
+#endif
   lk->cpu = 0;
+  lk->nacquire = lk->ncontend = lk->nspin = lk->holdcycles = 0;
+
+  push_off();
+  lk->reg = cpuid();
+  r = &lockreg[lk->reg];
+  acquire(&r->lock);
+  if(r->head.next == 0)
+    r->head.next = r->head.prev = &r->head;
+  lk->next = r->head.next;
+  lk->prev = &r->head;
+  r->head.next->prev = lk;
+  r->head.next = lk;
+  release(&r->lock);
+  pop_off();
+}
+
+// Take lk, which is about to be freed, off the list of locks.
+void
+freelock(struct spinlock *lk)
+{
+  struct lockreg *r = &lockreg[lk->reg];
+
+  acquire(&r->lock);
+  lk->next->prev = lk->prev;
+  lk->prev->next = lk->next;
+  release(&r->lock);
 }
 
 // Acquire the lock.
@@ -25,12 +67,22 @@ acquire(struct spinlock *lk)
   if(holding(lk))
     panic("acquire");
 
+  uint64 spins = 0;
+#ifdef TICKETLOCK
+  // Take a ticket with an atomic add (amoadd.w), then wait
+  // for our turn. Waiters only read serving, which the holder
+  // alone writes, so they don't fight over the cache line.
+  uint t = __sync_fetch_and_add(&lk->ticket, 1);
+  while(*(volatile uint*)&lk->serving != t)
+    spins++;
+#else
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    spins++;
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +92,13 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+  lk->nacquire++;
+  if(spins){
+    lk->ncontend++;
+    lk->nspin += spins;
+  }
+  lk->tacquire = r_time();
 }
 
 // Release the lock.
@@ -49,6 +108,7 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  lk->holdcycles += r_time() - lk->tacquire;
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,6 +119,11 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+#ifdef TICKETLOCK
+  // Serve the next ticket. Only the holder writes serving, but
+  // use an atomic add so the update is a single store.
+  __sync_fetch_and_add(&lk->serving, 1);
+#else
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -67,6 +132,7 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+#endif
 
   pop_off();
 }
@@ -77,10 +143,114 @@ int
 holding(struct spinlock *lk)
 {
   int r;
+#ifdef TICKETLOCK
+  r = (lk->serving != lk->ticket && lk->cpu == mycpu());
+#else
   r = (lk->locked && lk->cpu == mycpu());
+#endif
   return r;
 }
 
+// Copy statistics for up to n locks to the user array
+// of struct lockstat at addr; with addr 0, zero them instead.
+// The counters are read without taking each lock, so a
+// snapshot can be a little inconsistent. Entries are gathered
+// a page at a time into a kernel buffer and copied out with
+// no lock held, since copyout() may fault pages in. Returns
+// the number of entries copied, or -1.
+int
+lockstat(uint64 addr, int n)
+{
+  struct lockreg *r;
+  struct spinlock *lk;
+  struct lockstat *ls;
+  int i = 0, j, k, m;
+
+  if(addr == 0){
+    for(r = lockreg; r < &lockreg[NCPU]; r++){
+      acquire(&r->lock);
+      for(lk = r->head.next; lk && lk != &r->head; lk = lk->next)
+        lk->nacquire = lk->ncontend = lk->nspin = lk->holdcycles = 0;
+      release(&r->lock);
+    }
+    return 0;
+  }
+
+  if((ls = (struct lockstat*)kalloc()) == 0)
+    return -1;
+  for(r = lockreg; r < &lockreg[NCPU]; r++){
+    // k of this list's locks are already copied out.
+    for(k = 0; i < n; k += m){
+      m = 0;
+      acquire(&r->lock);
+      for(lk = r->head.next, j = 0; lk && lk != &r->head; lk = lk->next, j++){
+        if(j < k)
+          continue;
+        if(m == PGSIZE / sizeof(*ls) || i + m == n)
+          break;
+        safestrcpy(ls[m].name, lk->name, sizeof(ls[m].name));
+        ls[m].addr = (uint64)lk;
+        ls[m].nacquire = lk->nacquire;
+        ls[m].ncontend = lk->ncontend;
+        ls[m].nspin = lk->nspin;
+        ls[m].holdcycles = lk->holdcycles;
+        m++;
+      }
+      release(&r->lock);
+      if(m == 0)
+        break;
+      if(copyout(myproc()->pagetable, addr + i*sizeof(*ls), (char*)ls, m*sizeof(*ls)) < 0){
+        kfree(ls);
+        return -1;
+      }
+      i += m;
+    }
+  }
+  kfree(ls);
+  return i;
+}
+
+// A lock for lockbench() alone; zeroed is unlocked.
+static struct spinlock benchlock = { .name = "lockbench" };
+static int benchlast = -1;   // CPU that last released benchlock
+static uint64 benchrelease;  // and when
+
+// Microbenchmark: acquire and release benchlock, holding it
+// briefly, for the given number of mtime cycles, and report
+// how long each acquisition waited and how long the lock took
+// to pass from one CPU to another. Run from several processes
+// at once to compare lock implementations under contention.
+void
+lockbench(uint64 cycles, struct lockbench *r)
+{
+  uint64 start, t0, t1, wait;
+
+  memset(r, 0, sizeof(*r));
+  start = r_time();
+  do {
+    push_off();
+    t0 = r_time();
+    acquire(&benchlock);
+    t1 = r_time();
+    wait = t1 - t0;
+    r->nacquire++;
+    r->waitcycles += wait;
+    if(wait > r->maxwait)
+      r->maxwait = wait;
+    if(benchlast >= 0 && benchlast != cpuid()){
+      r->nhandoff++;
+      r->handoffcycles += t1 - benchrelease;
+    }
+    for(volatile int i = 0; i < 100; i++)
+      ;
+    benchlast = cpuid();
+    benchrelease = r_time();
+    release(&benchlock);
+    r->cpu = cpuid();
+    pop_off();
+  } while(t1 - start < cycles);
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
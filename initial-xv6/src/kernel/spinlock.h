@@ -1,9 +1,28 @@
 // Mutual exclusion lock.
+// With TICKETLOCK (make LOCK=ticket), CPUs take a ticket and
+// are served in order, so none can starve under contention;
+// otherwise it is a test-and-set lock.
 struct spinlock {
+#ifdef TICKETLOCK
+  uint ticket;       // Next ticket to hand out
+  uint serving;      // Ticket now allowed in; held iff != ticket
+#else
   uint locked;       // Is the lock held?
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // Statistics for lockstat(), protected by the lock itself:
+  uint64 nacquire;   // Acquisitions
+  uint64 ncontend;   // Acquisitions that found the lock held
+  uint64 nspin;      // Spin loop iterations
+  uint64 holdcycles; // Total time held, in mtime cycles
+  uint64 tacquire;   // When the current holder acquired it
+
+  struct spinlock *prev; // On a CPU's list of locks, built by initlock()
+  struct spinlock *next;
+  int reg;               // Which CPU's list
 };
 
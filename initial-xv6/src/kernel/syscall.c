@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "syscall.h"
+#include "sysstat.h"
 #include "defs.h"
 extern uint64 sys_getSysCount(void);
 extern struct
@@ -106,6 +107,12 @@ extern uint64 sys_waitx(void);
 extern uint64 sys_sigalarm(void);
 extern uint64 sys_sigreturn(void);
 extern uint64 sys_settickets(void);
+extern uint64 sys_getSysCounts(void);
+extern uint64 sys_sysstat(void);
+extern uint64 sys_profctl(void);
+extern uint64 sys_profread(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_lockbench(void);
 static uint64 (*syscalls[])(void) = {
     [SYS_fork] sys_fork,
     [SYS_exit] sys_exit,
@@ -133,19 +140,47 @@ static uint64 (*syscalls[])(void) = {
     [SYS_sigalarm]  sys_sigalarm,
     [SYS_sigreturn] sys_sigreturn,
      [SYS_settickets]    sys_settickets,
+    [SYS_getSysCounts] sys_getSysCounts,
+    [SYS_sysstat] sys_sysstat,
+    [SYS_profctl] sys_profctl,
+    [SYS_profread] sys_profread,
+    [SYS_lockstat] sys_lockstat,
+    [SYS_lockbench] sys_lockbench,
 };
 
+// Per-CPU syscall statistics. Each CPU only updates its own
+// row, with interrupts off, so counting takes no locks;
+// sys_sysstat() adds the rows up.
+static struct sysstat cpustats[NCPU];
+
 void syscall(void)
 {
   int num;
   struct proc *p = myproc();
+  struct sysstat *st;
+  uint64 start;
 
   num = p->trapframe->a7;
 
-  p->syscall_count[num]++;
-  if (num > 0 && num < NELEM(syscalls) && syscalls[num])
+  if (num > 0 && num < NELEM(syscalls) && num < NSYSSTAT && syscalls[num])
   {
+    if (num < MAX_SYSCALLS)
+      p->syscall_count[num]++;
+
+    // count the call up front, since exit() never returns.
+    push_off();
+    cpustats[cpuid()].count[num]++;
+    pop_off();
+
+    start = *(uint64 *)CLINT_MTIME;
     p->trapframe->a0 = syscalls[num]();
+
+    // the handler may have slept and moved to another CPU;
+    // charge its time to the one it finished on.
+    push_off();
+    st = &cpustats[cpuid()];
+    st->cycles[num] += *(uint64 *)CLINT_MTIME - start;
+    pop_off();
   }
   else
   {
@@ -154,3 +189,25 @@ void syscall(void)
     p->trapframe->a0 = -1;
   }
 }
+
+// Return a snapshot of the syscall statistics of all CPUs,
+// summed, in a struct sysstat at the user address in arg 0.
+uint64 sys_sysstat(void)
+{
+  struct sysstat st;
+  uint64 addr;
+
+  argaddr(0, &addr);
+  memset(&st, 0, sizeof(st));
+  for (int c = 0; c < NCPU; c++)
+  {
+    for (int i = 0; i < NSYSSTAT; i++)
+    {
+      st.count[i] += cpustats[c].count[i];
+      st.cycles[i] += cpustats[c].cycles[i];
+    }
+  }
+  if (copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
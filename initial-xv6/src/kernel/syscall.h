@@ -24,4 +24,10 @@
 #define SYS_getSysCount 23
 #define SYS_sigalarm  24  // Adjust number to fit your syscalls
 #define SYS_sigreturn 25
-#define SYS_settickets 26
\ No newline at end of file
+#define SYS_settickets 26
+#define SYS_getSysCounts 27
+#define SYS_sysstat 28
+#define SYS_profctl 29
+#define SYS_profread 30
+#define SYS_lockstat 31
+#define SYS_lockbench 32
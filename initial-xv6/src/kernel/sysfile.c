@@ -222,6 +222,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcset(dp, name, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -6,6 +6,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "syscall.h"
+#include "lockstat.h"
 #define NSYSCALLS 32 // Maximum number of system calls
 
 extern struct
@@ -64,14 +65,17 @@ sys_sleep(void)
 
   argint(0, &n);
   acquire(&tickslock);
-  ticks0 = ticks;
-  while (ticks - ticks0 < n)
+  ticks0 = tickupdate();
+  while (tickupdate() - ticks0 < n)
   {
     if (killed(myproc()))
     {
       release(&tickslock);
       return -1;
     }
+    // make sure some hart's timer fires by then.
+    if (ticks0 + n < nextwake)
+      nextwake = ticks0 + n;
     sleep(&ticks, &tickslock);
   }
   release(&tickslock);
@@ -87,17 +91,11 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
-// since start.
+// return how many clock ticks have passed since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
-
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  return tickupdate();
 }
 
 uint64
@@ -116,26 +114,6 @@ sys_waitx(void)
     return -1;
   return ret;
 }
-int sum_syscall_counts(struct proc *p, int syscall_num)
-{
-  if (p == 0)
-    return 0;
-
-  int count = p->syscall_count[syscall_num];
-
-  // Iterate through all child processes
-  struct proc *child;
-  for (child = proc; child < &proc[NPROC]; child++)
-  {
-    if (child->parent1 == p)
-    {
-      count += sum_syscall_counts(child, syscall_num);
-    }
-  }
-
-  return count;
-}
-
 int sys_getSysCount(void)
 {
   int mask;
@@ -154,12 +132,30 @@ int sys_getSysCount(void)
   if (syscall_num >= MAX_SYSCALLS)
     return -1; // Invalid syscall number
 
-  struct proc *current = myproc();
+  // wait() folds each reaped child's counts into its parent,
+  // so ours already cover every descendant that has exited.
+  return myproc()->syscall_count[syscall_num];
+}
 
-  // Sum syscall counts from current process and its descendants
-  int total_count = sum_syscall_counts(current, syscall_num);
+// Copy all of this process's syscall counts, indexed by syscall
+// number, to the user array counts[n] with a single copyout.
+// Returns the number of counts copied.
+uint64 sys_getSysCounts(void)
+{
+  uint64 addr;
+  int n;
 
-  return total_count;
+  argaddr(0, &addr);
+  argint(1, &n);
+  if (n < 0)
+    return -1;
+  if (n > MAX_SYSCALLS)
+    n = MAX_SYSCALLS;
+
+  struct proc *p = myproc();
+  if (copyout(p->pagetable, addr, (char *)p->syscall_count, n * sizeof(int)) < 0)
+    return -1;
+  return n;
 }
 
 
@@ -189,6 +185,7 @@ vaddr_check(uint64 addr)
     // Get the current process
     struct proc *p = myproc();
 // Acquire the process lock to modify its state
+    charge(); // don't count time from before the alarm was set
     acquire(&p->lock);
     p->alarmticks = ticks;
     p->ticks_elapsed = 0;
@@ -228,6 +225,8 @@ sys_settickets(void)
 {
     int num;
     argint(0, &num) ;
+    if (num < 1)
+        return -1; // a process with no tickets could never win
     struct proc *curproc = myproc();
     acquire(&curproc->lock);
     curproc->tickets = num;
@@ -235,3 +234,58 @@ sys_settickets(void)
     return curproc->tickets;
 }
 
+// Start the sampling profiler with the given interval in
+// mtime cycles, or stop it with 0. Returns samples dropped.
+uint64
+sys_profctl(void)
+{
+  uint64 interval;
+
+  argaddr(0, &interval);
+  return profctl(interval);
+}
+
+// Drain up to n profiler samples into a user array.
+uint64
+sys_profread(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if (n < 0)
+    return -1;
+  return profread(addr, n);
+}
+
+// Copy statistics for up to n spinlocks to a user array
+// of struct lockstat, or reset them all if the array is 0.
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if (n < 0)
+    return -1;
+  return lockstat(addr, n);
+}
+
+// Run the spinlock microbenchmark for the given number of
+// mtime cycles and copy a struct lockbench to the user.
+uint64
+sys_lockbench(void)
+{
+  uint64 cycles, addr;
+  struct lockbench r;
+
+  argaddr(0, &cycles);
+  argaddr(1, &addr);
+  lockbench(cycles, &r);
+  if (copyout(myproc()->pagetable, addr, (char *)&r, sizeof(r)) < 0)
+    return -1;
+  return 0;
+}
@@ -0,0 +1,7 @@
+// System-wide system call statistics, as returned by sysstat().
+#define NSYSSTAT 40   // slots, indexed by syscall number
+
+struct sysstat {
+  uint64 count[NSYSSTAT];  // Calls made, on all CPUs
+  uint64 cycles[NSYSSTAT]; // mtime cycles spent in each handler
+};
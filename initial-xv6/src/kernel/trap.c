@@ -8,6 +8,7 @@
 
 struct spinlock tickslock;
 uint ticks;
+uint nextwake = ~0; // earliest tick a sys_sleep() is waiting for
 
 extern char trampoline[], uservec[], userret[];
 
@@ -68,6 +69,14 @@ void usertrap(void)
   {
     // ok
   }
+  else if (r_scause() == 15 && cowfault(p->pagetable, r_stval()) == 0)
+  {
+    // store to a copy-on-write page; it is now private and writable.
+  }
+  else if ((r_scause() == 13 || r_scause() == 15) && vmfault(p->pagetable, r_stval()) != 0)
+  {
+    // first touch of a lazily allocated heap page.
+  }
   else
   {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
@@ -84,7 +93,8 @@ void usertrap(void)
 
   if (which_dev == 2)
   {
-    p->ticks++;
+    profsample(p->trapframe->epc, 1);
+
     // for graphing 
     // for (struct proc *i = proc; i < &proc[NPROC]; i++)
     // {
@@ -95,10 +105,9 @@ void usertrap(void)
 
     if (p->alarmticks > 0)
     {
-      // Increment the CPU ticks consumed by the process.
-      p->ticks_elapsed += 1;
-
+      // charge() counts the CPU ticks consumed by the process.
       // Check if the elapsed ticks have reached or exceeded the alarm interval.
+      charge();
       if (p->ticks_elapsed >= p->alarmticks)
       {
         // Reset the elapsed ticks counter.
@@ -121,11 +130,12 @@ void usertrap(void)
     }
     // writei()
 
-    yield();
+    // give up the CPU if its time slice is over.
+    if (preempt())
+      yield();
+    schedtimer();
   }
 
-  // give up the CPU if this is a timer interrupt.
-
   usertrapret();
 }
 
@@ -195,9 +205,15 @@ void kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  if (which_dev == 2)
+    profsample(sepc, 0);
+
+  // give up the CPU if this is a timer interrupt
+  // at the end of the process's time slice.
+  if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING && preempt())
     yield();
+  if (which_dev == 2)
+    schedtimer();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -205,38 +221,51 @@ void kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Bring ticks up to date with the CLINT's mtime, and return it.
+// Harts only take timer interrupts when they have a deadline,
+// so ticks is derived from mtime rather than counted, and any
+// hart may be the one to advance it. Takes no locks, so it can
+// be called from anywhere, e.g. sched() with p->lock held.
+uint tickupdate(void)
+{
+  uint now = *(uint64 *)CLINT_MTIME / TICKCYCLES;
+  uint t = ticks;
+
+  while (now > t && !__atomic_compare_exchange_n(&ticks, &t, now, 0,
+                                                  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    ;
+  return now > t ? now : t;
+}
+
+// Timer interrupt: advance ticks and wake sys_sleep()ers that
+// are due. Nothing here depends on how many processes exist.
 void clockintr()
 {
+  tickupdate();
+
   acquire(&tickslock);
-  ticks++;
-  update_time();
-  // struct proc* p;
-  // p=myproc();
-  // p->ticks++;
-  // for (struct proc *p = proc; p < &proc[NPROC]; p++)
-  // {
-  //   acquire(&p->lock);
-  //   if (p->state == RUNNING)
-  //   {
-  //     printf("here");
-  //     p->rtime++;
-  //   }
-  //   // if (p->state == SLEEPING)
-  //   // {
-  //   //   p->wtime++;
-  //   // }
-  //   release(&p->lock);
-  // }
-  struct proc *p;
-  for (int i = 0; i < NPROC; i++)
+  if (ticks >= nextwake)
   {
-    p = &proc[i];
-    p->ticks++;
+    nextwake = ~0;
+    wakeup(&ticks);
   }
-  wakeup(&ticks);
   release(&tickslock);
 }
 
+// Program this hart's one-shot timer to interrupt
+// when mtime reaches t; ~0 leaves it disarmed.
+void timerset(uint64 t)
+{
+  *(uint64 *)CLINT_MTIMECMP(cpuid()) = t;
+}
+
+// Send an inter-processor interrupt to hart id. timervec in
+// kernelvec.S passes it on as a supervisor software interrupt.
+void ipi(int id)
+{
+  *(uint32 *)CLINT_MSIP(id) = 1;
+}
+
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -277,18 +306,16 @@ int devintr()
   }
   else if (scause == 0x8000000000000001L)
   {
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
-
-    if (cpuid() == 0)
-    {
-      clockintr();
-    }
+    // software interrupt from a machine-mode timer interrupt
+    // or an ipi(), forwarded by timervec in kernelvec.S.
 
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, before anything that
+    // could make another hart send us an ipi().
     w_sip(r_sip() & ~2);
 
+    clockintr();
+
     return 2;
   }
   else
@@ -45,9 +45,10 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// at most this many virtio descriptors; one page of
+// struct virtq_desc. the driver uses the largest power
+// of two that both this and the device allow.
+#define NUM 256
 
 // a single descriptor, from the spec.
 struct virtq_desc {
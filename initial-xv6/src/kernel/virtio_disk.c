@@ -39,14 +39,20 @@ static struct disk {
   struct virtq_used *used;
 
   // our own book-keeping.
+  uint num;        // negotiated queue size, <= NUM.
   char free[NUM];  // is a descriptor free?
+  uint16 freelist[NUM]; // stack of free descriptor numbers.
+  uint nfree;
   uint16 used_idx; // we've looked this far in used[2..NUM].
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
+  // a request is either for buf b, or one of a
+  // virtio_disk_writev() batch, counted in *pending.
   struct {
     struct buf *b;
+    int *pending;
     char status;
   } info[NUM];
 
@@ -110,11 +116,16 @@ virtio_disk_init(void)
   if(*R(VIRTIO_MMIO_QUEUE_READY))
     panic("virtio disk should not be ready");
 
-  // check maximum queue size.
+  // check maximum queue size, and use as much of it as
+  // fits in our page-sized rings, so that many requests
+  // can be outstanding at once.
   uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
-  if(max < NUM)
+  disk.num = NUM;
+  while(disk.num > max)
+    disk.num >>= 1;
+  if(disk.num < 3)
     panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
@@ -128,7 +139,7 @@ virtio_disk_init(void)
   memset(disk.used, 0, PGSIZE);
 
   // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(VIRTIO_MMIO_QUEUE_NUM) = disk.num;
 
   // write physical addresses.
   *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
@@ -141,9 +152,11 @@ virtio_disk_init(void)
   // queue is ready.
   *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
 
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
+  // all descriptors start out unused.
+  for(int i = disk.num - 1; i >= 0; i--){
     disk.free[i] = 1;
+    disk.freelist[disk.nfree++] = i;
+  }
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
@@ -156,20 +169,18 @@ virtio_disk_init(void)
 static int
 alloc_desc()
 {
-  for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
-      return i;
-    }
-  }
-  return -1;
+  if(disk.nfree == 0)
+    return -1;
+  int i = disk.freelist[--disk.nfree];
+  disk.free[i] = 0;
+  return i;
 }
 
 // mark a descriptor as free.
 static void
 free_desc(int i)
 {
-  if(i >= NUM)
+  if(i >= disk.num)
     panic("free_desc 1");
   if(disk.free[i])
     panic("free_desc 2");
@@ -178,6 +189,7 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
+  disk.freelist[disk.nfree++] = i;
   wakeup(&disk.free[0]);
 }
 
@@ -196,12 +208,13 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// disk transfers use one for the request header, one per
+// block of data, and one for the status.
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +225,39 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// most blocks in one request; qemu takes up to queue size - 2.
+#define MAXSEG 16
+
+static int
+maxseg(void)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  return disk.num - 2 < MAXSEG ? disk.num - 2 : MAXSEG;
+}
 
-  acquire(&disk.vdisk_lock);
+// queue one request to read or write the n <= maxseg()
+// consecutive blocks starting at blockno, to or from data[i],
+// and return the index of its first descriptor, for the caller
+// to record what to do on completion in disk.info[].
+// caller must hold vdisk_lock.
+static int
+submit(uint blockno, uchar **data, int n, int write)
+{
+  uint64 sector = blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, then the data, then
+  // a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
+  int idx[MAXSEG + 2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n + 2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,27 +274,28 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 1; i <= n; i++){
+    disk.desc[idx[i]].addr = (uint64) data[i-1];
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[idx[0]].b = 0;
+  disk.info[idx[0]].pending = 0;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % disk.num] = idx[0];
 
   __sync_synchronize();
 
@@ -280,17 +306,67 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  return idx[0];
+}
+
+// queue a read or write of b and return without waiting
+// for it. the caller must hold b->lock, and must call
+// virtio_disk_wait(b) before using or releasing b.
+void
+virtio_disk_start(struct buf *b, int write)
+{
+  uchar *data = b->data;
+  int id;
+
+  acquire(&disk.vdisk_lock);
+  b->disk = 1;
+  id = submit(b->blockno, &data, 1, write);
+  // record struct buf for virtio_disk_intr().
+  disk.info[id].b = b;
+  release(&disk.vdisk_lock);
+}
+
+// write data[i] to block blockno[i] for i < n, and wait until
+// all are on disk. runs of consecutive blocks go to the device
+// as single scatter-gather requests, and every request is
+// queued before waiting, so a batch costs about one round trip.
+// data[] must stay unchanged until this returns.
+void
+virtio_disk_writev(uint *blockno, uchar **data, int n)
+{
+  int i, j, pending = 0;
+
+  acquire(&disk.vdisk_lock);
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n && j - i < maxseg() && blockno[j] == blockno[j-1] + 1; j++)
+      ;
+    pending++;
+    disk.info[submit(blockno[i], &data[i], j - i, 1)].pending = &pending;
+  }
+  while(pending > 0)
+    sleep(&pending, &disk.vdisk_lock);
+  release(&disk.vdisk_lock);
+}
+
+// wait for virtio_disk_intr() to say that a request
+// queued by virtio_disk_start(b) has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(b, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -311,14 +387,28 @@ virtio_disk_intr()
 
   while(disk.used_idx != disk.used->idx){
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int id = disk.used->ring[disk.used_idx % disk.num].id;
 
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
+    // requests complete in any order; retire this one's
+    // descriptors here so that no waiter has to.
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    int *pending = disk.info[id].pending;
+    disk.info[id].b = 0;
+    disk.info[id].pending = 0;
+    free_chain(id);
+    if(pending){
+      if(--*pending == 0)
+        wakeup(pending);   // whole batch is done
+    } else {
+      b->disk = 0;   // disk is done with buf
+      if(b->async)
+        bdone(b);    // read-ahead: no one is waiting
+      else
+        wakeup(b);
+    }
 
     disk.used_idx += 1;
   }
@@ -0,0 +1,78 @@
+// Spinlock microbenchmark: run the kernel's lockbench() in
+// several processes at once and report, for each, how often
+// it got the lock, how long it waited, and how long the lock
+// took to pass between CPUs. Compare a kernel built with
+// make LOCK=ticket against the default test-and-set lock.
+//
+// usage: lockbench [nproc [ticks]]
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int i, nproc = 3, ticks = 10;
+  int go[2], out[2];
+  struct lockbench r;
+  uint64 min = ~0UL, max = 0, total = 0;
+  char c;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    ticks = atoi(argv[2]);
+  if(nproc < 1 || ticks < 1){
+    fprintf(2, "usage: lockbench [nproc [ticks]]\n");
+    exit(1);
+  }
+
+  if(pipe(go) < 0 || pipe(out) < 0){
+    fprintf(2, "lockbench: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      // wait for every process to exist, then start together.
+      close(go[1]);
+      read(go[0], &c, 1);
+      lockbench((uint64)ticks * TICKCYCLES, &r);
+      write(out[1], &r, sizeof(r));
+      exit(0);
+    }
+  }
+  close(go[0]);
+  for(i = 0; i < nproc; i++)
+    write(go[1], "x", 1);
+
+  printf("cpu\tacquire\tavgwait\tmaxwait\thandoff\tavghandoff\n");
+  for(i = 0; i < nproc; i++){
+    if(read(out[0], &r, sizeof(r)) != sizeof(r))
+      break;
+    printf("%d\t%l\t%l\t%l\t%l\t%l\n", r.cpu, r.nacquire,
+           r.waitcycles / r.nacquire, r.maxwait, r.nhandoff,
+           r.nhandoff ? r.handoffcycles / r.nhandoff : 0);
+    total += r.nacquire;
+    if(r.nacquire < min)
+      min = r.nacquire;
+    if(r.nacquire > max)
+      max = r.nacquire;
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+
+  if(max == 0){
+    fprintf(2, "lockbench: no results\n");
+    exit(1);
+  }
+  // fairness: 100 means every process got the lock equally often.
+  printf("total %l acquisitions, fairness min/max %l%%\n", total, min * 100 / max);
+  exit(0);
+}
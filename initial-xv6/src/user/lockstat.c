@@ -0,0 +1,112 @@
+// Print spinlock contention statistics: totals for each lock
+// name, then the most contended individual locks. Given a
+// command, reset the counters, run it, and report on just that.
+//
+// usage: lockstat [command args...]
+
+#include "kernel/types.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define NLOCK 2048
+#define NTOP 20
+
+// All the locks with one name, e.g. every "proc" lock.
+struct total {
+  char *name;
+  int nlocks;
+  struct lockstat sum;
+};
+
+struct lockstat *ls;
+struct total *tot;
+
+// Sort a[0..n) by contended acquisitions, most first.
+void
+sortlocks(struct lockstat *a, int n)
+{
+  struct lockstat t;
+  int i, j;
+
+  for(i = 1; i < n; i++){
+    t = a[i];
+    for(j = i; j > 0 && a[j-1].ncontend < t.ncontend; j--)
+      a[j] = a[j-1];
+    a[j] = t;
+  }
+}
+
+void
+sorttotals(struct total *a, int n)
+{
+  struct total t;
+  int i, j;
+
+  for(i = 1; i < n; i++){
+    t = a[i];
+    for(j = i; j > 0 && a[j-1].sum.ncontend < t.sum.ncontend; j--)
+      a[j] = a[j-1];
+    a[j] = t;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n, nls, pid;
+
+  if(argc > 1){
+    lockstat(0, 0);
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], &argv[1]);
+      fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+
+  ls = malloc(NLOCK * sizeof(struct lockstat));
+  if((nls = lockstat(ls, NLOCK)) < 0){
+    fprintf(2, "lockstat: lockstat failed\n");
+    exit(1);
+  }
+
+  tot = malloc(nls * sizeof(struct total));
+  n = 0;
+  for(i = 0; i < nls; i++){
+    for(j = 0; j < n; j++)
+      if(strcmp(tot[j].name, ls[i].name) == 0)
+        break;
+    if(j == n){
+      memset(&tot[n], 0, sizeof(tot[n]));
+      tot[n++].name = ls[i].name;
+    }
+    tot[j].nlocks++;
+    tot[j].sum.nacquire += ls[i].nacquire;
+    tot[j].sum.ncontend += ls[i].ncontend;
+    tot[j].sum.nspin += ls[i].nspin;
+    tot[j].sum.holdcycles += ls[i].holdcycles;
+  }
+
+  // Sort the totals first: their names point into ls[].
+  sorttotals(tot, n);
+  printf("name\tlocks\tacquire\tcontend\tspins\tcycles\n");
+  for(j = 0; j < n; j++)
+    if(tot[j].sum.nacquire > 0)
+      printf("%s\t%d\t%l\t%l\t%l\t%l\n", tot[j].name, tot[j].nlocks,
+             tot[j].sum.nacquire, tot[j].sum.ncontend, tot[j].sum.nspin,
+             tot[j].sum.holdcycles);
+
+  sortlocks(ls, nls);
+  printf("\nmost contended locks:\n");
+  printf("name\taddr\tacquire\tcontend\tspins\tcycles\n");
+  for(i = 0; i < nls && i < NTOP && ls[i].ncontend > 0; i++)
+    printf("%s\t%p\t%l\t%l\t%l\t%l\n", ls[i].name, ls[i].addr, ls[i].nacquire,
+           ls[i].ncontend, ls[i].nspin, ls[i].holdcycles);
+  exit(0);
+}
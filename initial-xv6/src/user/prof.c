@@ -0,0 +1,170 @@
+// Run a command under the kernel's sampling profiler and print
+// a flat profile: samples per kernel function, symbolized
+// against /kernel.sym, with all user-mode samples in one line.
+//
+// usage: prof [-i cycles] command [args...]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/prof.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define KERNBASE 0x80000000L
+#define NTOP 30
+
+struct sym {
+  uint64 addr;
+  char *name;
+  int count;
+};
+
+struct sym *syms;
+int nsym;
+
+// Load "addr name" lines from kernel.sym, keeping
+// kernel text and data symbols, sorted by address.
+void
+loadsyms(char *file)
+{
+  int fd, n, i, j;
+  struct stat st;
+  char *buf, *p, *q;
+  struct sym t;
+
+  if((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    fprintf(2, "prof: cannot open %s\n", file);
+    exit(1);
+  }
+  buf = malloc(st.size + 1);
+  for(n = 0; n < st.size; n += i)
+    if((i = read(fd, buf + n, st.size - n)) <= 0)
+      break;
+  buf[n] = 0;
+  close(fd);
+
+  nsym = 0;
+  for(p = buf; *p; p++)
+    if(*p == '\n')
+      nsym++;
+  syms = malloc((nsym + 1) * sizeof(struct sym));
+
+  nsym = 0;
+  for(p = buf; *p; p = q){
+    uint64 addr = 0;
+    for(q = p; (*q >= '0' && *q <= '9') || (*q >= 'a' && *q <= 'f'); q++)
+      addr = addr * 16 + (*q <= '9' ? *q - '0' : *q - 'a' + 10);
+    if(*q == ' ')
+      q++;
+    char *name = q;
+    while(*q && *q != '\n')
+      q++;
+    if(*q)
+      *q++ = 0;
+    if(addr < KERNBASE || name[0] == '.' || name[0] == 0)
+      continue;
+    syms[nsym].addr = addr;
+    syms[nsym].name = name;
+    syms[nsym].count = 0;
+    nsym++;
+  }
+
+  // insertion sort; the file is nearly sorted already.
+  for(i = 1; i < nsym; i++){
+    t = syms[i];
+    for(j = i; j > 0 && syms[j-1].addr > t.addr; j--)
+      syms[j] = syms[j-1];
+    syms[j] = t;
+  }
+}
+
+// The symbol containing kernel address pc, or 0.
+struct sym*
+lookup(uint64 pc)
+{
+  int lo = 0, hi = nsym - 1, mid;
+
+  if(nsym == 0 || pc < syms[0].addr)
+    return 0;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(syms[mid].addr <= pc)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return &syms[lo];
+}
+
+struct profsample samples[64];
+
+int
+main(int argc, char *argv[])
+{
+  uint64 interval = TICKCYCLES / 100;
+  int i, n, pid, dropped, total = 0, user = 0, unknown = 0;
+  struct sym *s, *top[NTOP];
+
+  if(argc > 2 && strcmp(argv[1], "-i") == 0){
+    interval = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc < 2){
+    fprintf(2, "usage: prof [-i cycles] command [args...]\n");
+    exit(1);
+  }
+
+  loadsyms("/kernel.sym");
+
+  profctl(interval);
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], &argv[1]);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  dropped = profctl(0);
+
+  while((n = profread(samples, sizeof(samples)/sizeof(samples[0]))) > 0){
+    for(i = 0; i < n; i++){
+      total++;
+      if(samples[i].user)
+        user++;
+      else if((s = lookup(samples[i].pc)) != 0)
+        s->count++;
+      else
+        unknown++;
+    }
+  }
+
+  // pick the NTOP busiest symbols, busiest first.
+  for(i = 0; i < NTOP; i++)
+    top[i] = 0;
+  for(s = syms; s < syms + nsym; s++){
+    if(s->count == 0)
+      continue;
+    for(i = NTOP; i > 0 && (top[i-1] == 0 || top[i-1]->count < s->count); i--)
+      if(i < NTOP)
+        top[i] = top[i-1];
+    if(i < NTOP)
+      top[i] = s;
+  }
+
+  printf("%d samples, %d dropped\n", total, dropped);
+  if(total == 0)
+    exit(0);
+  printf("samples\t%%\tfunction\n");
+  printf("%d\t%d\t(user)\n", user, user * 100 / total);
+  for(i = 0; i < NTOP && top[i]; i++)
+    printf("%d\t%d\t%s\n", top[i]->count, top[i]->count * 100 / total, top[i]->name);
+  if(unknown)
+    printf("%d\t%d\t(unknown)\n", unknown, unknown * 100 / total);
+  exit(0);
+}
@@ -0,0 +1,85 @@
+// Print system-wide system call statistics: calls and mtime
+// cycles spent in each handler. Given a command, run it and
+// print only what happened while it ran.
+//
+// usage: sysstat [command args...]
+
+#include "kernel/types.h"
+#include "kernel/syscall.h"
+#include "kernel/sysstat.h"
+#include "user/user.h"
+
+char *names[NSYSSTAT] = {
+  [SYS_fork]         "fork",
+  [SYS_exit]         "exit",
+  [SYS_wait]         "wait",
+  [SYS_pipe]         "pipe",
+  [SYS_read]         "read",
+  [SYS_kill]         "kill",
+  [SYS_exec]         "exec",
+  [SYS_fstat]        "fstat",
+  [SYS_chdir]        "chdir",
+  [SYS_dup]          "dup",
+  [SYS_getpid]       "getpid",
+  [SYS_sbrk]         "sbrk",
+  [SYS_sleep]        "sleep",
+  [SYS_uptime]       "uptime",
+  [SYS_open]         "open",
+  [SYS_write]        "write",
+  [SYS_mknod]        "mknod",
+  [SYS_unlink]       "unlink",
+  [SYS_link]         "link",
+  [SYS_mkdir]        "mkdir",
+  [SYS_close]        "close",
+  [SYS_waitx]        "waitx",
+  [SYS_getSysCount]  "getSysCount",
+  [SYS_sigalarm]     "sigalarm",
+  [SYS_sigreturn]    "sigreturn",
+  [SYS_settickets]   "settickets",
+  [SYS_getSysCounts] "getSysCounts",
+  [SYS_sysstat]      "sysstat",
+  [SYS_profctl]      "profctl",
+  [SYS_profread]     "profread",
+  [SYS_lockstat]     "lockstat",
+  [SYS_lockbench]    "lockbench",
+};
+
+struct sysstat before, after;
+
+int
+main(int argc, char *argv[])
+{
+  int pid;
+
+  if(argc > 1){
+    if(sysstat(&before) < 0){
+      fprintf(2, "sysstat: sysstat failed\n");
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "sysstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], &argv[1]);
+      fprintf(2, "sysstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  if(sysstat(&after) < 0){
+    fprintf(2, "sysstat: sysstat failed\n");
+    exit(1);
+  }
+
+  printf("syscall\tcalls\tcycles\tcycles/call\n");
+  for(int i = 0; i < NSYSSTAT; i++){
+    uint64 n = after.count[i] - before.count[i];
+    uint64 cyc = after.cycles[i] - before.cycles[i];
+    if(n == 0)
+      continue;
+    printf("%s\t%l\t%l\t%l\n", names[i] ? names[i] : "?", n, cyc, cyc / n);
+  }
+  exit(0);
+}
@@ -1,4 +1,8 @@
 struct stat;
+struct sysstat;
+struct profsample;
+struct lockstat;
+struct lockbench;
 
 // #define unsigned int  unsigned int
 // system calls
@@ -28,6 +32,12 @@ int waitx(int*, int* /*wtime*/, int* /*rtime*/);
 int sigalarm(int ticks, void (*handler)());
 int sigreturn();
 int getSysCount(int mask, int pid);
+int getSysCounts(int *counts, int n);
+int sysstat(struct sysstat*);
+int profctl(uint64 interval);
+int profread(struct profsample*, int n);
+int lockstat(struct lockstat*, int n);
+int lockbench(uint64 cycles, struct lockbench*);
 // user.h
 int settickets(int count);
 
@@ -42,3 +42,9 @@ entry("sigalarm");
 entry("sigreturn");
 # entry("sigreturn");
 entry("settickets");
+entry("getSysCounts");
+entry("sysstat");
+entry("profctl");
+entry("profread");
+entry("lockstat");
+entry("lockbench");